@@ -32,228 +32,236 @@
  * 
  *
  * To compile:
- *   gcc -Wall -O3 -o actledPi actledPi.c
+ *   gcc -Wall -O3 -rdynamic -o actledPi actledPi.c piled.c vmstat.c -ldl -lpthread
  *
  * Options:
  * -d, --detach               Detach from terminal (become a daemon)
  * -r, --refresh=VALUE        Refresh interval (default: 20 ms)
+ *     --record=FILE          Record the I/O counters to a trace file
+ *     --replay=FILE          Drive the LED from a recorded trace instead of the live counters
+ * -s, --speed=FACTOR         Replay speed (default: 1, real time; 0: as fast as possible)
+ * -c, --config=FILE          Read the settings from a config file, reread on SIGHUP
+ * -a, --alarm                Blink a code on disk I/O errors
+ * -P, --plugin=FILE[:ARG]    Load a source or sink plugin (see piled.h); may be repeated
+ *     --no-led               Don't drive the LED, only the sinks of the plugins
+ *
+ * Config file - one "key = value" setting per line, # starts a comment.
+ * Settings in the config file take precedence over the command-line.
+ *   led = NAME               LED under /sys/class/leds to use (default: led0)
+ *   trigger = NAME           Trigger to give the LED back on exit (default: mmc0)
+ *   refresh = VALUE          Refresh interval in ms
+ *   counter = NAME           Watch this /proc/vmstat counter; may be repeated
+ *                            (default: pgpgin and pgpgout)
+ *   threshold = VALUE        Minimum change of the counters to light the LED (default: 1)
+ *   mode = normal|inverted   Light the LED on activity, or turn it off on activity
+ *   alarm = off|led          Blink a code on disk I/O errors
+ * Send SIGHUP to reread the config file. The new settings take effect between
+ * two refreshes; counters that are still watched keep their previous values.
+ *
+ * Alarm - on disk I/O errors, the LED shows a blink code of three short
+ * flashes instead of the disk activity.
  *
  */
 
 
-#define VMSTAT "/proc/vmstat"
-#define ACTLED "/sys/class/leds/led0/brightness"
-#define TRGCTL "/sys/class/leds/led0/trigger"
-#define LOW     0
-#define HIGH    1
-
+#define ACTLED "/sys/class/leds/%s/brightness"
+#define TRGCTL "/sys/class/leds/%s/trigger"
 #define _GNU_SOURCE
 
 #include <argp.h>
-#include <signal.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
-#include <unistd.h>
+#include "piled.h"
+#include "vmstat.h"
 
-static unsigned int o_refresh = 20; /* milliseconds */
-static int o_detach = 0;
+struct config {
+        char led[32];
+        char trigger[32];
+        FILE *actled;
+};
 
-static volatile sig_atomic_t running = 1;
-static char *line = NULL;
-static size_t len = 0;
+static struct config staged;            /* read from the config file */
+static struct config *cfg = NULL;       /* in use */
+static struct config *pending = NULL;   /* built last, not yet in use */
 
-FILE *actled = NULL;
 FILE *trigger_ctl = NULL;
 
-/* Reread the vmstat file */
-int activity(FILE *vmstat) {
-        static unsigned int prev_pgpgin, prev_pgpgout;
-        unsigned int pgpgin, pgpgout;
-        int found_pgpgin, found_pgpgout;
-        int result;
+/* Update the LED; the sink of the graph */
+static void led(void *arg, int on) {
+        const struct config *c = arg;
 
-        /* Reload the vmstat file */
-        result = TEMP_FAILURE_RETRY(fseek(vmstat, 0L, SEEK_SET));
-        if (result) {
-                perror("Could not rewind " VMSTAT);
-                return result;
+        if (on) {
+                fputs("255\n", c->actled);
+        } else {
+                fputs("0\n", c->actled);
         }
+        fflush(c->actled);
+}
 
-        /* Clear glibc's buffer */
-        result = TEMP_FAILURE_RETRY(fflush(vmstat));
-        if (result) {
-                perror("Could not flush input stream");
-                return result;
-        }
+/* Change the trigger of an LED */
+static int set_trigger(const char *name, const char *trigger) {
+        char path[PATH_MAX];
 
-        /* Extract the I/O stats */
-        found_pgpgin = found_pgpgout = 0;
-        while (getline(&line, &len, vmstat) != -1 && errno != EINTR) {
-                if (sscanf(line, "pgpgin %u", &pgpgin))
-                        found_pgpgin++;
-                else if (sscanf(line, "pgpgout %u", &pgpgout))
-                        found_pgpgout++;
-                if (found_pgpgin && found_pgpgout)
-                        break;
+        snprintf(path, sizeof(path), TRGCTL, name);
+        trigger_ctl = fopen(path, "w");
+        if (!trigger_ctl) {
+                perror("Unable to change LED trigger");
+                return -1;
         }
-        if (!found_pgpgin || !found_pgpgout) {
-                fprintf(stderr, "Could not find required lines in " VMSTAT);
+        fprintf(trigger_ctl, "%s\n", trigger);
+        if (fclose(trigger_ctl)) {
+                perror("Unable to change LED trigger");
                 return -1;
         }
+        return 0;
+}
+
+/* Take the LED over from its trigger, and open it for writing */
+static FILE *open_led(const char *name) {
+        char path[PATH_MAX];
+        FILE *file;
 
-        /* Anything changed? */
-        result =
-                (prev_pgpgin  != pgpgin) ||
-                (prev_pgpgout != pgpgout);
-        prev_pgpgin = pgpgin;
-        prev_pgpgout = pgpgout;
+        /* Change the trigger on the LED to "none" */
+        if (set_trigger(name, "none") < 0)
+                return NULL;
 
-        return result;
+        snprintf(path, sizeof(path), ACTLED, name);
+        file = fopen(path, "w");
+        if (!file)
+                fprintf(stderr, "Could not open %s for writing: %s\n", path, strerror(errno));
+        return file;
 }
 
-/* Update the LED */
-void led(int on) {
-        static int current = 1; /* Ensure the LED turns off on first call */
-        if (current == on)
+/* Give the LED of the settings back to its trigger */
+static void close_led(struct config *c) {
+        if (!c->actled)
                 return;
-
-        if (on) {
-                fputs("255\n", actled);
-        } else {
-                fputs("0\n", actled);
-        }
-        fflush(actled);
-        current = on;
+        fclose(c->actled);
+        set_trigger(c->led, c->trigger);
 }
 
-/* Signal handler -- break out of the main loop */
-void shutdown(int sig) {
-        running = 0;
+/* Fill in the settings from the command-line */
+static void defaults(void) {
+        memset(&staged, 0, sizeof(staged));
+        strcpy(staged.led, "led0");
+        strcpy(staged.trigger, "mmc0");
+        vmstat_defaults();
 }
 
-/* Argp parser function */
-error_t parse_options(int key, char *arg, struct argp_state *state) {
-        switch (key) {
-        case 'd':
-                o_detach = 1;
-                break;
-        case 'r':
-                o_refresh = strtol(arg, NULL, 10);
-                if (o_refresh < 10)
-                        argp_failure(state, EXIT_FAILURE, 0,
-                                "refresh interval must be at least 10");
-                break;
+/* Read a setting of actledPi from the config file */
+static int setting(struct piled_settings *s, const char *key, const char *value, const char **error) {
+        if (!strcmp(key, "led")) {
+                if (!*value || strchr(value, '/') || strlen(value) >= sizeof(staged.led))
+                        *error = "invalid LED name";
+                else
+                        strcpy(staged.led, value);
+        } else if (!strcmp(key, "trigger")) {
+                if (!*value || strlen(value) >= sizeof(staged.trigger))
+                        *error = "invalid trigger name";
+                else
+                        strcpy(staged.trigger, value);
+        } else {
+                return vmstat_setting(s, key, value, error);
         }
-        return 0;
+        return *error ? -1 : 0;
 }
 
-int main(int argc, char **argv) {
-        struct argp_option options[] = {
-                { "detach",  'd',      NULL, 0, "Detach from terminal" },
-                { "refresh", 'r',   "VALUE", 0, "Refresh interval (default: 20 ms)" },
-                { 0 },
-        };
-        struct argp parser = {
-                NULL, parse_options, NULL,
-                "Show disk activity on all disks.",
-                NULL, NULL, NULL
-        };
-        int status = EXIT_FAILURE;
-        FILE *vmstat = NULL;
-        struct timespec delay;
-
-        /* Parse the command-line */
-        parser.options = options;
-        if (argp_parse(&parser, argc, argv, ARGP_NO_ARGS, NULL, NULL))
-                goto out;
-
-        delay.tv_sec = o_refresh / 1000;
-        delay.tv_nsec = 1000000 * (o_refresh % 1000);
+/* Add the vmstat source and the LED sink to the graph */
+static int build(struct piled *p, const struct piled_settings *s) {
+        struct config *c;
 
+        if (vmstat_build(p, s) < 0)
+                return -1;
 
-        /* Open the vmstat file */
-        vmstat = fopen(VMSTAT, "r");
-        if (!vmstat) {
-                perror("Could not open " VMSTAT " for reading");
-                goto out;
+        c = malloc(sizeof(*c));
+        if (!c) {
+                perror("Could not allocate settings");
+                return -1;
         }
-
-        /* Change the trigger on the OK/Act LED to "none" */
-
-        trigger_ctl = fopen(TRGCTL, "rw");
-        if (!trigger_ctl) {
-                perror("Unable to change LED trigger");
-                goto out;
+        *c = staged;
+        c->actled = NULL;
+        if (!s->leds)
+                goto done;
+
+        /* Keep the LED open if it stays the same */
+        if (cfg && cfg->actled && !strcmp(c->led, cfg->led)) {
+                c->actled = cfg->actled;
+        } else {
+                c->actled = open_led(c->led);
+                if (!c->actled) {
+                        set_trigger(c->led, c->trigger);
+                        goto fail;
+                }
         }
-        fputs ("none\n", trigger_ctl);
-        fclose (trigger_ctl);
-
-
-        /* Open the actled file */
-        actled = fopen(ACTLED, "w");
-        if (!actled) {
-                perror("Could not open " ACTLED " for writing");
-                goto out;
+        if (piled_add_sink(p, c->led, PILED_SINK_ACTIVITY, led, c) < 0) {
+                if (!cfg || c->actled != cfg->actled)
+                        close_led(c);
+                goto fail;
         }
 
-        /* Ensure the LED is off */
-        led(LOW);
+done:
+        free(pending);
+        pending = c;
+        return 0;
 
-        if (activity(vmstat) < 0)
-                goto out;
+fail:
+        free(c);
+        return -1;
+}
 
-        /* Detach from terminal? */
-        if (o_detach) {
-                pid_t child = fork();
-                if (child < 0) {
-                        perror("Could not detach from terminal");
-                        goto out;
-                }
-                if (child) {
-                        /* I am the parent */
-                        status = EXIT_SUCCESS;
-                        goto out;
-                }
-        }
+/* Switch to the settings of the graph built last, or drop them */
+static void commit(int ok) {
+        struct config *dropped = ok ? cfg : pending;
+        struct config *kept = ok ? pending : cfg;
+
+        vmstat_commit(ok);
+        if (dropped && (!kept || dropped->actled != kept->actled))
+                close_led(dropped);
+        free(dropped);
+        cfg = kept;
+        pending = NULL;
+}
 
-        /* We catch these signals so we can clean up */
-        {
-                struct sigaction action;
-                memset(&action, 0, sizeof(action));
-                action.sa_handler = shutdown;
-                sigemptyset(&action.sa_mask);
-                action.sa_flags = 0; /* We block on usleep; don't use SA_RESTART */
-                sigaction(SIGHUP, &action, NULL);
-                sigaction(SIGINT, &action, NULL);
-                sigaction(SIGTERM, &action, NULL);
+/* Close the files, and give the LED back to its trigger */
+static void cleanup(void) {
+        if (cfg) {
+                close_led(cfg);
+                free(cfg);
+                cfg = NULL;
         }
+        vmstat_cleanup();
+}
 
-        /* Loop until signal received */
-        while (running) {
-                int a;
-                if (nanosleep(&delay, NULL) < 0)
-                        break;
-                a = activity(vmstat);
-                if (a < 0)
-                        break;
-                led(a);
-        }
+/* Argp parser function */
+static error_t parse_options(int key, char *arg, struct argp_state *state) {
+        struct piled_settings *s = state->input;
 
-        /* Ensure the LED is off */
-        led(LOW);
+        switch (key) {
+        case 'a':
+                s->alarm = PILED_ALARM_ON;
+                break;
+        default:
+                return ARGP_ERR_UNKNOWN;
+        }
+        return 0;
+}
 
-        status = EXIT_SUCCESS;
+int main(int argc, char **argv) {
+        static struct argp_option options[] = {
+                { "alarm",   'a',        NULL, 0, "Blink a code on disk I/O errors" },
+                { 0 },
+        };
+        static const struct argp parser = {
+                options, parse_options, NULL, NULL,
+                NULL, NULL, NULL
+        };
+        static const struct piled_program program = {
+                "Show disk activity on all disks.",
+                &parser, defaults, setting, build, commit, cleanup
+        };
 
-out:
-        if (line) free(line);
-        if (vmstat) fclose(vmstat);
-        if (actled) {
-                fclose(actled);
-                trigger_ctl = fopen(TRGCTL, "rw");
-                fputs("mmc0\n", trigger_ctl);
-                fclose(trigger_ctl);
-        }
-        return status;
+        return piled_main(&program, argc, argv);
 }
@@ -0,0 +1,153 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ *
+ **************************************************************************
+ *
+ * gpioled - see gpioled.h.
+ * This uses the WiringPi library by Gordon Henderson - http://wiringpi.com/
+ */
+
+
+#define ALARM_OFF -1
+#define ALARM_LED -2
+
+
+#define _GNU_SOURCE
+
+#include <argp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wiringPi.h>
+#include "gpioled.h"
+
+
+static unsigned int o_gpiopin = 0; /* wiringPi numbering scheme */
+static int o_alarm = ALARM_OFF;
+
+struct config {
+        unsigned int gpiopin;   /* wiringPi numbering scheme */
+        int alarm;              /* ALARM_OFF, ALARM_LED or a GPIO pin */
+};
+
+static struct config staged;    /* read from the config file */
+
+/* Update an LED; the sinks of the graph */
+static void led(void *arg, int on) {
+        if (on) {
+                digitalWrite ((intptr_t)arg, HIGH);
+        } else {
+                digitalWrite ((intptr_t)arg, LOW);
+        }
+}
+
+void gpioled_init(unsigned int pin) {
+        o_gpiopin = pin;
+}
+
+error_t gpioled_parse(int key, char *arg, struct argp_state *state) {
+        struct piled_settings *s = state->input;
+
+        switch (key) {
+        case 'p':
+                o_gpiopin = strtol(arg, NULL, 10);
+                if ((o_gpiopin < 0) || (o_gpiopin > 29))
+                        argp_failure(state, EXIT_FAILURE, 0,
+                                "pin number must be between 0 and 29");
+                break;
+        case 'a':
+                o_alarm = ALARM_LED;
+                if (arg) {
+                        o_alarm = strtol(arg, NULL, 10);
+                        if ((o_alarm < 0) || (o_alarm > 29))
+                                argp_failure(state, EXIT_FAILURE, 0,
+                                        "alarm pin number must be between 0 and 29");
+                }
+                s->alarm = PILED_ALARM_ON;
+                break;
+        case ARGP_KEY_END:
+                if (o_alarm == (int)o_gpiopin)
+                        argp_failure(state, EXIT_FAILURE, 0,
+                                "alarm pin must not be the LED pin");
+                break;
+        default:
+                return ARGP_ERR_UNKNOWN;
+        }
+        return 0;
+}
+
+void gpioled_defaults(void) {
+        staged.gpiopin = o_gpiopin;
+        staged.alarm = o_alarm;
+}
+
+int gpioled_setting(struct piled_settings *s, const char *key, const char *value, const char **error) {
+        if (!strcmp(key, "pin")) {
+                if (piled_number(value, &staged.gpiopin) || staged.gpiopin > 29)
+                        *error = "pin number must be between 0 and 29";
+        } else if (!strcmp(key, "alarm")) {
+                unsigned int pin;
+                if (!strcmp(value, "off"))
+                        staged.alarm = ALARM_OFF;
+                else if (!strcmp(value, "led"))
+                        staged.alarm = ALARM_LED;
+                else if (piled_number(value, &pin) || pin > 29)
+                        *error = "alarm must be off, led or a pin number between 0 and 29";
+                else
+                        staged.alarm = pin;
+                s->alarm = staged.alarm == ALARM_OFF ? PILED_ALARM_OFF : PILED_ALARM_ON;
+        } else {
+                return 1;
+        }
+        return *error ? -1 : 0;
+}
+
+int gpioled_build(struct piled *p, const struct piled_settings *s) {
+        static int setup = 0;
+        char name[PILED_MAXNAME];
+
+        if (staged.alarm == (int)staged.gpiopin) {
+                fprintf(stderr, "Alarm pin must not be the LED pin\n");
+                return -1;
+        }
+        if (!s->leds)
+                return 0;
+
+        if (!setup++)
+                wiringPiSetup () ;
+        pinMode (staged.gpiopin, OUTPUT) ;
+        snprintf(name, sizeof(name), "gpio%u", staged.gpiopin);
+        if (piled_add_sink(p, name, PILED_SINK_ACTIVITY, led, (void *)(intptr_t)staged.gpiopin) < 0)
+                return -1;
+        if (staged.alarm >= 0) {
+                pinMode (staged.alarm, OUTPUT) ;
+                snprintf(name, sizeof(name), "gpio%u", staged.alarm);
+                if (piled_add_sink(p, name, PILED_SINK_ALARM, led, (void *)(intptr_t)staged.alarm) < 0)
+                        return -1;
+        }
+        return 0;
+}
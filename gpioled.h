@@ -0,0 +1,55 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ *
+ **************************************************************************
+ *
+ * The GPIO LEDs of hddledPi and netledPi: the LED, and the alarm LED if it
+ * has a pin of its own. The hooks are those of struct piled_program, for
+ * the programs to call from theirs; gpioled_parse() handles -p and -a.
+ */
+
+#ifndef GPIOLED_H
+#define GPIOLED_H
+
+#include <argp.h>
+#include "piled.h"
+
+/* Set the default LED pin; call before piled_main() */
+void gpioled_init(unsigned int pin);
+
+/* Argp parser function for -p and -a */
+error_t gpioled_parse(int key, char *arg, struct argp_state *state);
+
+/* Take the pins from the command-line */
+void gpioled_defaults(void);
+
+/* The "pin" and "alarm" config file settings; returns 1 for other keys */
+int gpioled_setting(struct piled_settings *s, const char *key, const char *value, const char **error);
+
+/* Add the sinks to the graph */
+int gpioled_build(struct piled *p, const struct piled_settings *s);
+
+#endif /* GPIOLED_H */
@@ -0,0 +1,561 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ *
+ **************************************************************************
+ *
+ * piledlat - measure the latency from disk or network activity to the LED.
+ *
+ * For every refresh interval and display mode asked for, piledlat starts
+ * the daemon with --no-led and the shmsink plugin, which timestamps the
+ * edges of a mock LED in shared memory. It then makes events of real
+ * activity, spaced well apart and timestamped just before they start:
+ * O_DIRECT writes to a file or loop device for the disk daemons, or a
+ * burst of UDP packets out of a dummy or veth interface for netledPi.
+ * The latency of an event is the time to the first edge of the LED to
+ * its activity state (on in normal mode, off in inverted mode) before
+ * the next event; an event without one is missed. Activity edges that
+ * belong to no event, from other activity on the machine, are counted
+ * as extra.
+ *
+ * To compile:
+ *   gcc -Wall -O3 -o piledlat harness/piledlat.c -lrt
+ *   gcc -Wall -O3 -shared -fPIC -I. -o shmsink.so harness/shmsink.c -lrt
+ *
+ * Options:
+ * -t, --target=disk|net      What activity to make (default: disk)
+ * -D, --daemon=FILE          Daemon to measure (default: ./actledPi or ./netledPi)
+ * -P, --plugin=FILE          The shmsink plugin (default: ./shmsink.so)
+ * -f, --file=FILE            File or loop device to write to (default: a temporary file in /var/tmp)
+ * -i, --interface=NAME       Interface to send the UDP packets out of, and the only one netledPi watches
+ * -A, --address=IP           Where to send the UDP packets (default: 10.213.0.2)
+ * -r, --refresh=LIST         Refresh intervals in ms to measure (default: 10,20,50)
+ * -m, --modes=LIST           Display modes to measure (default: normal,inverted)
+ * -n, --events=VALUE         Events per run (default: 200)
+ * -g, --gap=VALUE            Time between events in ms, plus a random part of up to one refresh interval (default: 200)
+ * -b, --burst=VALUE          KiB per write, or packets per burst (default: 64, 8)
+ *
+ * A dummy interface for the network runs:
+ *   sudo ip link add piled0 type dummy
+ *   sudo ip addr add 10.213.0.1/24 dev piled0
+ *   sudo ip link set piled0 up
+ *   sudo ./piledlat -t net -i piled0
+ * or a veth pair, with a fixed neighbour so the packets don't wait for ARP:
+ *   sudo ip link add piled0 type veth peer name piled1
+ *   sudo ip addr add 10.213.0.1/24 dev piled0
+ *   sudo ip link set piled0 up; sudo ip link set piled1 up
+ *   sudo ip neigh add 10.213.0.2 lladdr 02:00:00:00:00:02 dev piled0
+ */
+
+
+#define SHM_NAME "/piledlat"
+#define DEFAULT_ADDRESS "10.213.0.2"
+#define UDP_PORT 9      /* discard */
+#define MAXRUNS 16
+#define AREA (16 * 1024 * 1024)         /* bytes of the file written over */
+#define READY_TIMEOUT 5000              /* ms */
+
+#define TARGET_DISK 0
+#define TARGET_NET 1
+
+
+#define _GNU_SOURCE
+
+#include <argp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "piledlat.h"
+
+
+static int o_target = TARGET_DISK;
+static char *o_daemon = NULL;
+static char *o_plugin = "./shmsink.so";
+static char *o_file = NULL;
+static char *o_interface = NULL;
+static char *o_address = DEFAULT_ADDRESS;
+static unsigned int o_refresh[MAXRUNS] = { 10, 20, 50 };
+static unsigned int o_nrefresh = 3;
+static int o_modes[2] = { 1, 1 };      /* normal, inverted */
+static unsigned int o_events = 200;
+static unsigned int o_gap = 200; /* milliseconds */
+static unsigned int o_burst = 0;
+
+static volatile sig_atomic_t running = 1;
+
+static struct piledlat_shm *shm = NULL;
+static int target_fd = -1;
+static void *block = NULL;
+static struct sockaddr_in address;
+static char *tempfile = NULL;
+
+/* Current time in nanoseconds */
+static uint64_t now_nsec(void) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* Sleep for a number of milliseconds, unless interrupted */
+static void sleep_msec(unsigned int msec) {
+        struct timespec delay;
+
+        delay.tv_sec = msec / 1000;
+        delay.tv_nsec = 1000000 * (msec % 1000);
+        nanosleep(&delay, NULL);
+}
+
+/* Open what the events write to */
+static int open_target(void) {
+        if (o_target == TARGET_NET) {
+                target_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+                if (target_fd < 0) {
+                        perror("Could not create UDP socket");
+                        return -1;
+                }
+                if (o_interface && setsockopt(target_fd, SOL_SOCKET, SO_BINDTODEVICE,
+                                o_interface, strlen(o_interface) + 1) < 0) {
+                        perror("Could not bind to interface");
+                        return -1;
+                }
+                memset(&address, 0, sizeof(address));
+                address.sin_family = AF_INET;
+                address.sin_port = htons(UDP_PORT);
+                if (inet_pton(AF_INET, o_address, &address.sin_addr) != 1) {
+                        fprintf(stderr, "Invalid address: %s\n", o_address);
+                        return -1;
+                }
+                return 0;
+        }
+
+        if (!o_file) {
+                tempfile = strdup("/var/tmp/piledlat.XXXXXX");
+                if (!tempfile) {
+                        perror("Could not create temporary file");
+                        return -1;
+                }
+                target_fd = mkstemp(tempfile);
+                if (target_fd < 0) {
+                        perror("Could not create temporary file");
+                        return -1;
+                }
+                close(target_fd);
+                o_file = tempfile;
+        }
+        target_fd = open(o_file, O_WRONLY | O_DIRECT | O_CLOEXEC);
+        if (target_fd < 0) {
+                fprintf(stderr, "Could not open %s for O_DIRECT writing: %s\n", o_file, strerror(errno));
+                return -1;
+        }
+        if (posix_memalign(&block, 4096, o_burst * 1024)) {
+                perror("Could not allocate write buffer");
+                return -1;
+        }
+        memset(block, 0xa5, o_burst * 1024);
+        return 0;
+}
+
+/* Make one event of activity */
+static int activity(unsigned int i) {
+        unsigned int j;
+
+        if (o_target == TARGET_NET) {
+                for (j = 0; j < o_burst; j++) {
+                        if (sendto(target_fd, "piledlat", 8, 0,
+                                        (struct sockaddr *)&address, sizeof(address)) < 0) {
+                                perror("Could not send UDP packet");
+                                return -1;
+                        }
+                }
+                return 0;
+        }
+
+        if (pwrite(target_fd, block, o_burst * 1024,
+                        (off_t)i * o_burst * 1024 % AREA) != (ssize_t)o_burst * 1024) {
+                perror("Could not write");
+                return -1;
+        }
+        return 0;
+}
+
+/* Start the daemon for a run */
+static pid_t start_daemon(unsigned int refresh, int mode, const char *config) {
+        char plugin[PATH_MAX + sizeof(SHM_NAME) + 1];
+        char resolved[PATH_MAX];
+        char refresh_arg[16];
+        FILE *file;
+        pid_t child;
+
+        /* mode is only a config file setting */
+        file = fopen(config, "w");
+        if (!file) {
+                fprintf(stderr, "Could not create %s: %s\n", config, strerror(errno));
+                return -1;
+        }
+        fprintf(file, "mode = %s\n", mode ? "inverted" : "normal");
+        if (o_target == TARGET_NET && o_interface)
+                fprintf(file, "interface = %s\n", o_interface);
+        fclose(file);
+
+        /* dlopen() searches the library path for names without a slash */
+        if (!realpath(o_plugin, resolved)) {
+                fprintf(stderr, "Could not find %s: %s\n", o_plugin, strerror(errno));
+                return -1;
+        }
+        snprintf(plugin, sizeof(plugin), "%s:" SHM_NAME, resolved);
+        snprintf(refresh_arg, sizeof(refresh_arg), "%u", refresh);
+
+        memset(shm, 0, sizeof(*shm));
+        shm->magic = PILEDLAT_MAGIC;
+
+        child = fork();
+        if (child < 0) {
+                perror("Could not start daemon");
+                return -1;
+        }
+        if (!child) {
+                execl(o_daemon, o_daemon, "--no-led", "-r", refresh_arg,
+                      "-c", config, "-P", plugin, (char *)NULL);
+                fprintf(stderr, "Could not run %s: %s\n", o_daemon, strerror(errno));
+                _exit(EXIT_FAILURE);
+        }
+        return child;
+}
+
+/* Wait until the daemon has turned the mock LED off, and has its first sample */
+static int wait_ready(pid_t child, unsigned int refresh) {
+        unsigned int waited;
+        int status;
+
+        for (waited = 0; waited < READY_TIMEOUT; waited += 10) {
+                if (__atomic_load_n(&shm->nedges, __ATOMIC_ACQUIRE))
+                        break;
+                if (waitpid(child, &status, WNOHANG) == child) {
+                        fprintf(stderr, "The daemon exited\n");
+                        return -1;
+                }
+                sleep_msec(10);
+        }
+        if (waited >= READY_TIMEOUT) {
+                fprintf(stderr, "The daemon did not set the mock LED\n");
+                return -1;
+        }
+
+        /* Let the mock LED settle to its idle state */
+        sleep_msec(3 * refresh + 100);
+        return 0;
+}
+
+/* Compare two latencies for qsort() */
+static int compare(const void *a, const void *b) {
+        uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+        return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile of sorted latencies, in ms */
+static double percentile(const uint64_t *sorted, unsigned int n, unsigned int p) {
+        unsigned int rank = (n * p + 99) / 100;
+        return sorted[rank ? rank - 1 : 0] / 1e6;
+}
+
+/* Match the events with the edges of the mock LED, and print a line of results */
+static void report(const char *target, unsigned int refresh, int mode,
+                   const uint64_t *events, unsigned int nevents, uint64_t end) {
+        uint64_t *latency = malloc(nevents * sizeof(*latency));
+        const struct piledlat_edge *edges = shm->edges;
+        unsigned int nedges = __atomic_load_n(&shm->nedges, __ATOMIC_ACQUIRE);
+        unsigned int active = !mode; /* the state of the mock LED on activity */
+        unsigned int i, e = 0, nlatency = 0, nactive = 0;
+
+        if (!latency) {
+                perror("Could not allocate latencies");
+                return;
+        }
+
+        /* The first edge to the activity state between an event and the next is its response */
+        for (i = 0; i < nevents; i++) {
+                uint64_t until = i + 1 < nevents ? events[i + 1] : end;
+                while (e < nedges && edges[e].nsec < events[i])
+                        e++;
+                while (e < nedges && edges[e].nsec < until && edges[e].on != active)
+                        e++;
+                if (e < nedges && edges[e].nsec < until)
+                        latency[nlatency++] = edges[e++].nsec - events[i];
+        }
+
+        /* Edges to the activity state that answered no event */
+        for (e = 0; e < nedges; e++)
+                if (nevents && edges[e].nsec >= events[0] && edges[e].nsec < end && edges[e].on == active)
+                        nactive++;
+
+        qsort(latency, nlatency, sizeof(*latency), compare);
+        printf("%-6s  %-8s  %7u  %6u  %6.1f%%",
+               target, mode ? "inverted" : "normal", refresh, nevents,
+               nevents ? 100.0 * (nevents - nlatency) / nevents : 0.0);
+        if (nlatency)
+                printf("  %7.2f  %7.2f  %7.2f  %7.2f",
+                       percentile(latency, nlatency, 50), percentile(latency, nlatency, 90),
+                       percentile(latency, nlatency, 99), latency[nlatency - 1] / 1e6);
+        else
+                printf("  %7s  %7s  %7s  %7s", "-", "-", "-", "-");
+        printf("  %6u\n", nactive - nlatency);
+        fflush(stdout);
+        free(latency);
+}
+
+/* One run of the daemon: returns 0, or -1 on error */
+static int run(unsigned int refresh, int mode) {
+        char config[] = "/tmp/piledlat.conf.XXXXXX";
+        uint64_t *events;
+        unsigned int i, n = 0;
+        int result = -1;
+        pid_t child;
+        int fd;
+
+        events = malloc(o_events * sizeof(*events));
+        if (!events) {
+                perror("Could not allocate events");
+                return -1;
+        }
+        fd = mkstemp(config);
+        if (fd < 0) {
+                perror("Could not create config file");
+                free(events);
+                return -1;
+        }
+        close(fd);
+
+        child = start_daemon(refresh, mode, config);
+        if (child < 0)
+                goto out;
+        if (wait_ready(child, refresh) < 0)
+                goto stop;
+
+        for (i = 0; i < o_events && running; i++) {
+                events[n++] = now_nsec();
+                if (activity(i) < 0)
+                        goto stop;
+                /* A random part, so the events don't keep in step with the refreshes */
+                sleep_msec(o_gap + rand() % refresh);
+        }
+
+        report(o_target == TARGET_NET ? "net" : "disk", refresh, mode, events, n, now_nsec());
+        result = 0;
+
+stop:
+        kill(child, SIGTERM);
+        waitpid(child, NULL, 0);
+out:
+        unlink(config);
+        free(events);
+        return result;
+}
+
+/* Signal handler -- stop after the current event */
+static void interrupt(int sig) {
+        running = 0;
+}
+
+/* Argp parser function */
+static error_t parse_options(int key, char *arg, struct argp_state *state) {
+        char *item;
+
+        switch (key) {
+        case 't':
+                if (!strcmp(arg, "disk"))
+                        o_target = TARGET_DISK;
+                else if (!strcmp(arg, "net"))
+                        o_target = TARGET_NET;
+                else
+                        argp_failure(state, EXIT_FAILURE, 0,
+                                "target must be disk or net");
+                break;
+        case 'D':
+                o_daemon = arg;
+                break;
+        case 'P':
+                o_plugin = arg;
+                break;
+        case 'f':
+                o_file = arg;
+                break;
+        case 'i':
+                o_interface = arg;
+                break;
+        case 'A':
+                o_address = arg;
+                break;
+        case 'r':
+                o_nrefresh = 0;
+                for (item = strtok(arg, ","); item; item = strtok(NULL, ",")) {
+                        if (o_nrefresh == MAXRUNS)
+                                argp_failure(state, EXIT_FAILURE, 0,
+                                        "too many refresh intervals");
+                        o_refresh[o_nrefresh] = strtol(item, NULL, 10);
+                        if (o_refresh[o_nrefresh++] < 10)
+                                argp_failure(state, EXIT_FAILURE, 0,
+                                        "refresh interval must be at least 10");
+                }
+                break;
+        case 'm':
+                o_modes[0] = o_modes[1] = 0;
+                for (item = strtok(arg, ","); item; item = strtok(NULL, ",")) {
+                        if (!strcmp(item, "normal"))
+                                o_modes[0] = 1;
+                        else if (!strcmp(item, "inverted"))
+                                o_modes[1] = 1;
+                        else
+                                argp_failure(state, EXIT_FAILURE, 0,
+                                        "mode must be normal or inverted");
+                }
+                break;
+        case 'n':
+                o_events = strtol(arg, NULL, 10);
+                if (o_events < 1 || o_events > PILEDLAT_MAXEDGES / 4)
+                        argp_failure(state, EXIT_FAILURE, 0,
+                                "number of events must be between 1 and %u", PILEDLAT_MAXEDGES / 4);
+                break;
+        case 'g':
+                o_gap = strtol(arg, NULL, 10);
+                if (o_gap < 20)
+                        argp_failure(state, EXIT_FAILURE, 0,
+                                "gap must be at least 20");
+                break;
+        case 'b':
+                o_burst = strtol(arg, NULL, 10);
+                if (o_burst < 1 || o_burst > 4096)
+                        argp_failure(state, EXIT_FAILURE, 0,
+                                "burst must be between 1 and 4096");
+                break;
+        case ARGP_KEY_END:
+                if (!o_daemon)
+                        o_daemon = o_target == TARGET_NET ? "./netledPi" : "./actledPi";
+                if (!o_burst)
+                        o_burst = o_target == TARGET_NET ? 8 : 64;
+                break;
+        }
+        return 0;
+}
+
+int main(int argc, char **argv) {
+        struct argp_option options[] = {
+                { "target",    't', "disk|net", 0, "What activity to make (default: disk)" },
+                { "daemon",    'D',     "FILE", 0, "Daemon to measure (default: ./actledPi or ./netledPi)" },
+                { "plugin",    'P',     "FILE", 0, "The shmsink plugin (default: ./shmsink.so)" },
+                { "file",      'f',     "FILE", 0, "File or loop device to write to (default: a temporary file in /var/tmp)" },
+                { "interface", 'i',     "NAME", 0, "Interface to send the UDP packets out of, and the only one netledPi watches" },
+                { "address",   'A',       "IP", 0, "Where to send the UDP packets (default: " DEFAULT_ADDRESS ")" },
+                { "refresh",   'r',     "LIST", 0, "Refresh intervals in ms to measure (default: 10,20,50)" },
+                { "modes",     'm',     "LIST", 0, "Display modes to measure (default: normal,inverted)" },
+                { "events",    'n',    "VALUE", 0, "Events per run (default: 200)" },
+                { "gap",       'g',    "VALUE", 0, "Time between events in ms, plus a random part of up to one refresh interval (default: 200)" },
+                { "burst",     'b',    "VALUE", 0, "KiB per write, or packets per burst (default: 64, 8)" },
+                { 0 },
+        };
+        struct argp parser = {
+                NULL, parse_options, NULL,
+                "Measure the latency from disk or network activity to the LED of the daemons.",
+                NULL, NULL, NULL
+        };
+        int status = EXIT_FAILURE;
+        unsigned int i;
+        int fd, mode;
+
+        /* Parse the command-line */
+        parser.options = options;
+        if (argp_parse(&parser, argc, argv, ARGP_NO_ARGS, NULL, NULL))
+                goto out;
+
+        /* Create the shared memory for the edges */
+        fd = shm_open(SHM_NAME, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0) {
+                perror("Could not create shared memory");
+                goto out;
+        }
+        if (ftruncate(fd, sizeof(*shm)) < 0) {
+                perror("Could not size shared memory");
+                close(fd);
+                goto out;
+        }
+        shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (shm == MAP_FAILED) {
+                perror("Could not map shared memory");
+                shm = NULL;
+                goto out;
+        }
+
+        if (open_target() < 0)
+                goto out;
+
+        /* We catch these signals so we can stop the daemon */
+        {
+                struct sigaction action;
+                memset(&action, 0, sizeof(action));
+                action.sa_handler = interrupt;
+                sigemptyset(&action.sa_mask);
+                sigaction(SIGINT, &action, NULL);
+                sigaction(SIGTERM, &action, NULL);
+        }
+
+        srand(now_nsec());
+        printf("target  mode      refresh  events  missed   p50 ms   p90 ms   p99 ms   max ms   extra\n");
+        for (i = 0; i < o_nrefresh && running; i++) {
+                for (mode = 0; mode < 2 && running; mode++) {
+                        if (!o_modes[mode])
+                                continue;
+                        if (run(o_refresh[i], mode) < 0)
+                                goto out;
+                }
+        }
+
+        status = EXIT_SUCCESS;
+
+out:
+        if (target_fd >= 0) close(target_fd);
+        if (tempfile) {
+                unlink(tempfile);
+                free(tempfile);
+        }
+        free(block);
+        if (shm) {
+                munmap(shm, sizeof(*shm));
+                shm_unlink(SHM_NAME);
+        }
+        return status;
+}
@@ -0,0 +1,54 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ *
+ **************************************************************************
+ *
+ * The shared memory between piledlat and its shmsink plugin: the edges of
+ * the mock LED, timestamped by the daemon as it sets them. piledlat
+ * creates and empties it, the plugin appends to it.
+ */
+
+#ifndef PILEDLAT_H
+#define PILEDLAT_H
+
+#include <stdint.h>
+
+#define PILEDLAT_MAGIC 0x504c4154       /* "PLAT" */
+#define PILEDLAT_MAXEDGES 65536
+
+struct piledlat_edge {
+        uint64_t nsec;                  /* CLOCK_MONOTONIC */
+        uint32_t on;
+        uint32_t pad;
+};
+
+struct piledlat_shm {
+        uint32_t magic;
+        uint32_t nedges;                /* published with release ordering, after the edge */
+        struct piledlat_edge edges[PILEDLAT_MAXEDGES];
+};
+
+#endif /* PILEDLAT_H */
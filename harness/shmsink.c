@@ -0,0 +1,105 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ *
+ **************************************************************************
+ *
+ * shmsink - a piled plugin with a mock LED, for measuring latency with
+ * piledlat. Every time the daemon turns the LED on or off, the edge is
+ * timestamped and appended to the shared memory object named by the
+ * plugin argument, which piledlat has created.
+ *
+ * To compile:
+ *   gcc -Wall -O3 -shared -fPIC -I. -o shmsink.so harness/shmsink.c -lrt
+ *
+ * Usage:
+ *   actledPi --no-led -P ./shmsink.so:/piledlat
+ */
+
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "piled.h"
+#include "piledlat.h"
+
+
+PILED_PLUGIN_DEFINE_VERSION;
+
+static struct piledlat_shm *shm = NULL;
+
+/* Timestamp an edge of the mock LED */
+static void edge(void *arg, int on) {
+        struct timespec now;
+        uint32_t n;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        n = __atomic_load_n(&shm->nedges, __ATOMIC_RELAXED);
+        if (n == PILEDLAT_MAXEDGES)
+                return;
+        shm->edges[n].nsec = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+        shm->edges[n].on = on;
+        __atomic_store_n(&shm->nedges, n + 1, __ATOMIC_RELEASE);
+}
+
+int piled_plugin_init(struct piled *p, const char *arg) {
+        int fd;
+
+        if (!arg) {
+                fprintf(stderr, "shmsink: needs the name of the shared memory object\n");
+                return -1;
+        }
+
+        fd = shm_open(arg, O_RDWR, 0);
+        if (fd < 0) {
+                perror("shmsink: could not open shared memory");
+                return -1;
+        }
+        shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (shm == MAP_FAILED) {
+                perror("shmsink: could not map shared memory");
+                shm = NULL;
+                return -1;
+        }
+        if (shm->magic != PILEDLAT_MAGIC) {
+                fprintf(stderr, "shmsink: %s was not created by piledlat\n", arg);
+                munmap(shm, sizeof(*shm));
+                shm = NULL;
+                return -1;
+        }
+
+        return piled_add_sink(p, "shmsink", PILED_SINK_ACTIVITY, edge, NULL);
+}
+
+void piled_plugin_exit(void) {
+        if (shm)
+                munmap(shm, sizeof(*shm));
+        shm = NULL;
+}
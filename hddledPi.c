@@ -31,17 +31,39 @@
  * 
  *
  * To compile:
- *   gcc -Wall -O3 -o hddledPi hddledPi.c -lwiringPi
+ *   gcc -Wall -O3 -rdynamic -o hddledPi hddledPi.c piled.c vmstat.c gpioled.c -lwiringPi -ldl -lpthread
  *
  * Options:
  * -d, --detach               Detach from terminal (become a daemon)
  * -p, --pin=VALUE            GPIO pin (using wiringPi numbering scheme) where LED is connected (default: 10) 
  * -r, --refresh=VALUE        Refresh interval (default: 20 ms)
+ * -c, --config=FILE          Read the settings from a config file, reread on SIGHUP
+ * -a, --alarm[=PIN]          Blink a code on disk I/O errors, on the LED or on its own GPIO pin
+ * -P, --plugin=FILE[:ARG]    Load a source or sink plugin (see piled.h); may be repeated
+ *     --no-led               Don't drive the LED, only the sinks of the plugins
+ *     --record=FILE          Record the I/O counters to a trace file
+ *     --replay=FILE          Drive the LED from a recorded trace instead of the live counters
+ * -s, --speed=FACTOR         Replay speed (default: 1, real time; 0: as fast as possible)
  *
  * Default LED Pin - wiringPi pin 10 is BCM_GPIO 8, physical pin 24 on the Pi's P1 header.
  * Note: This pin is also used for the SPI interface. If you have SPI add-ons connected,
  * you'll have to use the -p option to change it to another, unused pin.
  *
+ * Config file - one "key = value" setting per line, # starts a comment.
+ * Settings in the config file take precedence over the command-line.
+ *   pin = VALUE              GPIO pin where LED is connected
+ *   refresh = VALUE          Refresh interval in ms
+ *   counter = NAME           Watch this /proc/vmstat counter; may be repeated
+ *                            (default: pgpgin and pgpgout)
+ *   threshold = VALUE        Minimum change of the counters to light the LED (default: 1)
+ *   mode = normal|inverted   Light the LED on activity, or turn it off on activity
+ *   alarm = off|led|PIN      Blink a code on disk I/O errors, on the LED or on its own pin
+ * Send SIGHUP to reread the config file. The new settings take effect between
+ * two refreshes; counters that are still watched keep their previous values.
+ *
+ * Alarm - on disk I/O errors, the LED shows a blink code of three short
+ * flashes instead of the disk activity, or the code is shown on the alarm pin.
+ *
  * GPIO pin ----|>|----[330]----+
  *              LED             |
  *                             ===
@@ -49,204 +71,53 @@
  */
 
 
-#define VMSTAT "/proc/vmstat"
-
-
-#define _GNU_SOURCE
-
 #include <argp.h>
-#include <signal.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <time.h>
-#include <unistd.h>
-#include <wiringPi.h>
-
-
-static unsigned int o_refresh = 20; /* milliseconds */
-static unsigned int o_gpiopin = 10; /* wiringPi numbering scheme */
-static int o_detach = 0;
-
-static volatile sig_atomic_t running = 1;
-static char *line = NULL;
-static size_t len = 0;
-
-/* Reread the vmstat file */
-int activity(FILE *vmstat) {
-        static unsigned int prev_pgpgin, prev_pgpgout;
-        unsigned int pgpgin, pgpgout;
-        int found_pgpgin, found_pgpgout;
-        int result;
+#include "gpioled.h"
+#include "piled.h"
+#include "vmstat.h"
 
-        /* Reload the vmstat file */
-        result = TEMP_FAILURE_RETRY(fseek(vmstat, 0L, SEEK_SET));
-        if (result) {
-                perror("Could not rewind " VMSTAT);
-                return result;
-        }
 
-        /* Clear glibc's buffer */
-        result = TEMP_FAILURE_RETRY(fflush(vmstat));
-        if (result) {
-                perror("Could not flush input stream");
-                return result;
-        }
-
-        /* Extract the I/O stats */
-        found_pgpgin = found_pgpgout = 0;
-        while (getline(&line, &len, vmstat) != -1 && errno != EINTR) {
-                if (sscanf(line, "pgpgin %u", &pgpgin))
-                        found_pgpgin++;
-                else if (sscanf(line, "pgpgout %u", &pgpgout))
-                        found_pgpgout++;
-                if (found_pgpgin && found_pgpgout)
-                        break;
-        }
-        if (!found_pgpgin || !found_pgpgout) {
-                fprintf(stderr, "Could not find required lines in " VMSTAT);
-                return -1;
-        }
-
-        /* Anything changed? */
-        result =
-                (prev_pgpgin  != pgpgin) ||
-                (prev_pgpgout != pgpgout);
-        prev_pgpgin = pgpgin;
-        prev_pgpgout = pgpgout;
-
-        return result;
+/* Fill in the settings from the command-line */
+static void defaults(void) {
+        vmstat_defaults();
+        gpioled_defaults();
 }
 
-/* Update the LED */
-void led(int on) {
-        static int current = 1; /* Ensure the LED turns off on first call */
-        if (current == on)
-                return;
-
-        if (on) {
-                digitalWrite (o_gpiopin, HIGH);
-        } else {
-                digitalWrite (o_gpiopin, LOW);
-        }
-
-        current = on;
+/* Read a setting of hddledPi from the config file */
+static int setting(struct piled_settings *s, const char *key, const char *value, const char **error) {
+        int result = vmstat_setting(s, key, value, error);
+        if (result == 1)
+                result = gpioled_setting(s, key, value, error);
+        return result;
 }
 
-/* Signal handler -- break out of the main loop */
-void shutdown(int sig) {
-        running = 0;
+/* Add the vmstat source and the GPIO sinks to the graph */
+static int build(struct piled *p, const struct piled_settings *s) {
+        if (vmstat_build(p, s) < 0)
+                return -1;
+        return gpioled_build(p, s);
 }
 
-/* Argp parser function */
-error_t parse_options(int key, char *arg, struct argp_state *state) {
-        switch (key) {
-        case 'd':
-                o_detach = 1;
-                break;
-        case 'r':
-                o_refresh = strtol(arg, NULL, 10);
-                if (o_refresh < 10)
-                        argp_failure(state, EXIT_FAILURE, 0,
-                                "refresh interval must be at least 10");
-                break;
-        case 'p':
-                o_gpiopin = strtol(arg, NULL, 10);
-                if ((o_gpiopin < 0) || (o_gpiopin > 29))
-                        argp_failure(state, EXIT_FAILURE, 0,
-                                "pin number must be between 0 and 29");
-                break;
-        }
-        return 0;
+/* Switch to the settings of the graph built last, or drop them */
+static void commit(int ok) {
+        vmstat_commit(ok);
 }
 
 int main(int argc, char **argv) {
-        struct argp_option options[] = {
-                { "detach",  'd',      NULL, 0, "Detach from terminal" },
-                { "pin",     'p',   "VALUE", 0, "GPIO pin where LED is connected (default: wiringPi pin 10, physical pin 24 on the P1 header)" },
-                { "refresh", 'r',   "VALUE", 0, "Refresh interval (default: 20 ms)" },
+        static struct argp_option options[] = {
+                { "pin",     'p',     "VALUE", 0, "GPIO pin where LED is connected (default: wiringPi pin 10, physical pin 24 on the P1 header)" },
+                { "alarm",   'a',       "PIN", OPTION_ARG_OPTIONAL, "Blink a code on disk I/O errors, on the LED or on its own GPIO pin" },
                 { 0 },
         };
-        struct argp parser = {
-                NULL, parse_options, NULL,
-                "Show disk activity using an LED wired to a GPIO pin.",
+        static const struct argp parser = {
+                options, gpioled_parse, NULL, NULL,
                 NULL, NULL, NULL
         };
-        int status = EXIT_FAILURE;
-        FILE *vmstat = NULL;
-        struct timespec delay;
-
-        /* Parse the command-line */
-        parser.options = options;
-        if (argp_parse(&parser, argc, argv, ARGP_NO_ARGS, NULL, NULL))
-                goto out;
-
-        delay.tv_sec = o_refresh / 1000;
-        delay.tv_nsec = 1000000 * (o_refresh % 1000);
-
-        wiringPiSetup () ;
-        pinMode (o_gpiopin, OUTPUT) ;
-
-
-        /* Open the vmstat file */
-        vmstat = fopen(VMSTAT, "r");
-        if (!vmstat) {
-                perror("Could not open " VMSTAT " for reading");
-                goto out;
-        }
-
-        /* Ensure the LED is off */
-        led(LOW);
-
-        /* Save the current I/O stat values */
-        if (activity(vmstat) < 0)
-                goto out;
-
-        /* Detach from terminal? */
-        if (o_detach) {
-                pid_t child = fork();
-                if (child < 0) {
-                        perror("Could not detach from terminal");
-                        goto out;
-                }
-                if (child) {
-                        /* I am the parent */
-                        status = EXIT_SUCCESS;
-                        goto out;
-                }
-        }
-
-        /* We catch these signals so we can clean up */
-        {
-                struct sigaction action;
-                memset(&action, 0, sizeof(action));
-                action.sa_handler = shutdown;
-                sigemptyset(&action.sa_mask);
-                action.sa_flags = 0; /* We block on usleep; don't use SA_RESTART */
-                sigaction(SIGHUP, &action, NULL);
-                sigaction(SIGINT, &action, NULL);
-                sigaction(SIGTERM, &action, NULL);
-        }
-
-        /* Loop until signal received */
-        while (running) {
-                int a;
-                if (nanosleep(&delay, NULL) < 0)
-                        break;
-                a = activity(vmstat);
-                if (a < 0)
-                        break;
-                led(a);
-        }
-
-        /* Ensure the LED is off */
-        led(LOW);
-
-        status = EXIT_SUCCESS;
+        static const struct piled_program program = {
+                "Show disk activity using an LED wired to a GPIO pin.",
+                &parser, defaults, setting, build, commit, vmstat_cleanup
+        };
 
-out:
-        if (line) free(line);
-        if (vmstat) fclose(vmstat);
-        return status;
+        gpioled_init(10);
+        return piled_main(&program, argc, argv);
 }
-
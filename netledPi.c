@@ -31,12 +31,19 @@
  * 
  *
  * To compile:
- *   gcc -Wall -O3 -o netledPi netledPi.c -lwiringPi
+ *   gcc -Wall -O3 -rdynamic -o netledPi netledPi.c piled.c gpioled.c -lwiringPi -ldl -lpthread
  *
  * Options:
  * -d, --detach               Detach from terminal (become a daemon)
  * -p, --pin=VALUE            GPIO pin (using wiringPi numbering scheme) where LED is connected (default: 11)
  * -r, --refresh=VALUE        Refresh interval (default: 20 ms)
+ * -c, --config=FILE          Read the settings from a config file, reread on SIGHUP
+ * -a, --alarm[=PIN]          Blink a code on network errors and drops, on the LED or on its own GPIO pin
+ * -P, --plugin=FILE[:ARG]    Load a source or sink plugin (see piled.h); may be repeated
+ *     --no-led               Don't drive the LED, only the sinks of the plugins
+ *     --record=FILE          Record the packet counters to a trace file
+ *     --replay=FILE          Drive the LED from a recorded trace instead of the live counters
+ * -s, --speed=FACTOR         Replay speed (default: 1, real time; 0: as fast as possible)
  *
  * GPIO pin ----|>|----[330]----+
  *              LED             |
@@ -46,42 +53,97 @@
  * Default LED Pin - wiringPi pin 11 is BCM_GPIO 7, physical pin 26 on the Pi's P1 header.
  * Note: This pin is also used for the SPI interface. If you have SPI add-ons connected,
  * you'll have to use the -p option to change it to another, unused pin.
+ *
+ * Config file - one "key = value" setting per line, # starts a comment.
+ * Settings in the config file take precedence over the command-line.
+ *   pin = VALUE              GPIO pin where LED is connected
+ *   refresh = VALUE          Refresh interval in ms
+ *   interface = NAME         Only watch this interface; may be repeated (default: all)
+ *   ignore = NAME            Don't watch this interface; may be repeated (default: lo)
+ *   threshold = VALUE        Minimum number of packets to light the LED (default: 1)
+ *   mode = normal|inverted   Light the LED on activity, or turn it off on activity
+ *   alarm = off|led|PIN      Blink a code on network errors and drops, on the LED or on its own pin
+ * Send SIGHUP to reread the config file. The new settings take effect between
+ * two refreshes; the packet counts are kept unless the interfaces change.
+ *
+ * Alarm - the error (errs, fifo, frame, colls, carrier) and drop counts of
+ * the watched interfaces are read along with the packet counts. While the
+ * alarm is on, the LED shows a blink code of three short flashes instead
+ * of the network activity, or the code is shown on the alarm pin.
  */
 
 
 #define NETDEVICES "/proc/net/dev"
+#define NSOURCES 2      /* received and transmitted packets */
+#define NALARMS 2       /* errors, drops */
+#define MAXINTERFACES 16
 
 
 #define _GNU_SOURCE
 
 #include <argp.h>
-#include <signal.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 #include <unistd.h>
-#include <wiringPi.h>
+#include "gpioled.h"
+#include "piled.h"
 
 
-static unsigned int o_refresh = 20; /* milliseconds */
-static unsigned int o_gpiopin = 11; /* wiringPi numbering scheme */
-static int o_detach = 0;
+struct config {
+        unsigned int ninterfaces;
+        char interfaces[MAXINTERFACES][32];
+        unsigned int nignored;
+        char ignored[MAXINTERFACES][32];
+        unsigned int generation;        /* bumped when the interfaces change */
+};
 
-static volatile sig_atomic_t running = 1;
+static struct config staged;            /* read from the config file */
+static struct config *cfg = NULL;       /* in use */
+static struct config *pending = NULL;   /* built last, not yet in use */
+static int staged_ignored = 0;
+
+static FILE *netdevices = NULL;
 static char *line = NULL;
 static size_t len = 0;
 
-/* Reread the netdevices file */
-int activity(FILE *netdevices) {
-        static unsigned int prev_inpackets, prev_outpackets;
-        unsigned int inpackets, outpackets;
-        unsigned int device_inpackets, device_outpackets;
+/* Is the interface watched? */
+static int watched(const struct config *c, const char *device) {
+        unsigned int i;
+
+        for (i = 0; i < c->nignored; i++)
+                if (!strcmp(device, c->ignored[i]))
+                        return 0;
+        if (!c->ninterfaces)
+                return 1;
+        for (i = 0; i < c->ninterfaces; i++)
+                if (!strcmp(device, c->interfaces[i]))
+                        return 1;
+        return 0;
+}
+
+/* Reread the netdevices file; the source of the graph */
+static int sample(void *arg, uint64_t *values) {
+        const struct config *c = arg;
+        uint64_t inpackets, outpackets, errs, drops;
+        uint64_t field[11];
         int found_inpackets, found_outpackets;
         int result;
         char *ptr;
         char device[32];
 
+        /* Open the netdevices file on first use */
+        if (!netdevices) {
+                netdevices = fopen(NETDEVICES, "r");
+                if (!netdevices) {
+                        perror("Could not open " NETDEVICES " for reading");
+                        return -1;
+                }
+        }
+
         /* Go to the beginning of the netdevices file */
         result = TEMP_FAILURE_RETRY(fseek(netdevices, 0L, SEEK_SET));
         if (result) {
@@ -97,164 +159,141 @@ int activity(FILE *netdevices) {
         }
 
         /* Extract the I/O stats */
-        inpackets = outpackets = 0;
+        inpackets = outpackets = errs = drops = 0;
         found_inpackets = found_outpackets = 0;
-        device_inpackets = device_outpackets = 0;
+        errno = 0;
         while (getline(&line, &len, netdevices) != -1 && errno != EINTR) {
                 ptr = line;
                 while (*ptr == ' ') ptr++; // Skip leading spaces
-                if (sscanf(ptr, "%s %*u %u %*u %*u %*u %*u %*u %*u %*u %u %*u %*u %*u %*u %*u %*u", device, &device_inpackets, &device_outpackets)) {
-                        if(strstr(device, "lo:")) continue; // Skip loopback interface
+                /* Receive: packets errs drop fifo frame, transmit: packets errs drop fifo colls carrier */
+                if (sscanf(ptr, "%31s %*u %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %*u %*u "
+                                "%*u %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %*u",
+                                device, &field[0], &field[1], &field[2], &field[3], &field[4],
+                                &field[5], &field[6], &field[7], &field[8], &field[9], &field[10]) == 12) {
                         found_inpackets++;
                         found_outpackets++;
-                        inpackets += device_inpackets;
-                        outpackets += device_outpackets;
+                        device[strcspn(device, ":")] = '\0';
+                        if (!watched(c, device)) continue;
+                        inpackets += field[0];
+                        outpackets += field[5];
+                        errs += field[1] + field[3] + field[4] + field[6] + field[8] + field[9] + field[10];
+                        drops += field[2] + field[7];
                 }
 
         }
         if (!found_inpackets || !found_outpackets) {
-                fprintf(stderr, "Could not find required lines in " NETDEVICES);
+                fprintf(stderr, "Could not find required lines in " NETDEVICES "\n");
                 return -1;
         }
 
-        /* Anything changed? */
-        result = (prev_inpackets  != inpackets) ||
-                 (prev_outpackets != outpackets);
-        prev_inpackets = inpackets;
-        prev_outpackets = outpackets;
-
-        return result;
-}
-
-/* Update the LED */
-void led(int on) {
-        static int current = 1; /* Ensure the LED turns off on first call */
-        if (current == on)
-                return;
-
-        if (on) {
-                digitalWrite (o_gpiopin, HIGH);
-        } else {
-                digitalWrite (o_gpiopin, LOW);
-        }
-
-        current = on;
+        values[0] = inpackets;
+        values[1] = outpackets;
+        values[2] = errs;
+        values[3] = drops;
+        return 0;
 }
 
-/* Signal handler -- break out of the main loop */
-void shutdown(int sig) {
-        running = 0;
+/* Fill in the settings from the command-line */
+static void defaults(void) {
+        memset(&staged, 0, sizeof(staged));
+        staged.nignored = 1;
+        strcpy(staged.ignored[0], "lo");
+        staged_ignored = 0;
+        gpioled_defaults();
 }
 
-/* Argp parser function */
-error_t parse_options(int key, char *arg, struct argp_state *state) {
-        switch (key) {
-        case 'd':
-                o_detach = 1;
-                break;
-        case 'r':
-                o_refresh = strtol(arg, NULL, 10);
-                if (o_refresh < 10)
-                        argp_failure(state, EXIT_FAILURE, 0,
-                                "refresh interval must be at least 10");
-                break;
-        case 'p':
-                o_gpiopin = strtol(arg, NULL, 10);
-                if ((o_gpiopin < 0) || (o_gpiopin > 29))
-                        argp_failure(state, EXIT_FAILURE, 0,
-                                "pin number must be between 0 and 29");
-                break;
+/* Read a setting of netledPi from the config file */
+static int setting(struct piled_settings *s, const char *key, const char *value, const char **error) {
+        if (!strcmp(key, "interface")) {
+                if (staged.ninterfaces == MAXINTERFACES)
+                        *error = "too many interfaces";
+                else if (!*value || strlen(value) >= sizeof(staged.interfaces[0]))
+                        *error = "invalid interface name";
+                else
+                        strcpy(staged.interfaces[staged.ninterfaces++], value);
+        } else if (!strcmp(key, "ignore")) {
+                /* The first ignored interface replaces the default one */
+                if (!staged_ignored++)
+                        staged.nignored = 0;
+                if (staged.nignored == MAXINTERFACES)
+                        *error = "too many interfaces";
+                else if (!*value || strlen(value) >= sizeof(staged.ignored[0]))
+                        *error = "invalid interface name";
+                else
+                        strcpy(staged.ignored[staged.nignored++], value);
+        } else {
+                return gpioled_setting(s, key, value, error);
         }
-        return 0;
+        return *error ? -1 : 0;
 }
 
-int main(int argc, char **argv) {
-        struct argp_option options[] = {
-                { "detach",  'd',      NULL, 0, "Detach from terminal" },
-                { "pin",     'p',   "VALUE", 0, "GPIO pin where LED is connected (default: wiringPi pin 11, physical pin 25 on the P1 header)" },
-                { "refresh", 'r',   "VALUE", 0, "Refresh interval (default: 20 ms)" },
-                { 0 },
-        };
-        struct argp parser = {
-                NULL, parse_options, NULL,
-                "Show network activity using an LED wired to a GPIO pin.",
-                NULL, NULL, NULL
+/* Add the netdevices source and the GPIO sinks to the graph */
+static int build(struct piled *p, const struct piled_settings *s) {
+        static const char *const names[NSOURCES + NALARMS] = {
+                "rx_packets", "tx_packets", "errors", "drops"
         };
-        int status = EXIT_FAILURE;
-        FILE *netdevices = NULL;
-        struct timespec delay;
-
-        /* Parse the command-line */
-        parser.options = options;
-        if (argp_parse(&parser, argc, argv, ARGP_NO_ARGS, NULL, NULL))
-                goto out;
+        char name[PILED_MAXNAME];
+        struct config *c;
 
-        delay.tv_sec = o_refresh / 1000;
-        delay.tv_nsec = 1000000 * (o_refresh % 1000);
-
-        wiringPiSetup () ;
-        pinMode (o_gpiopin, OUTPUT) ;
-
-
-        /* Open the netdevices file */
-        netdevices = fopen(NETDEVICES, "r");
-        if (!netdevices) {
-                perror("Could not open " NETDEVICES " for reading");
-                goto out;
+        c = malloc(sizeof(*c));
+        if (!c) {
+                perror("Could not allocate settings");
+                return -1;
         }
-
-        /* Ensure the LED is off */
-        led(LOW);
-
-        /* Save the current I/O stat values */
-        if (activity(netdevices) < 0)
-                goto out;
-
-        /* Detach from terminal? */
-        if (o_detach) {
-                pid_t child = fork();
-                if (child < 0) {
-                        perror("Could not detach from terminal");
-                        goto out;
-                }
-                if (child) {
-                        /* I am the parent */
-                        status = EXIT_SUCCESS;
-                        goto out;
-                }
+        *c = staged;
+
+        /* The packet counts only need a new baseline if the interfaces change */
+        if (cfg && (c->ninterfaces != cfg->ninterfaces || c->nignored != cfg->nignored ||
+            memcmp(c->interfaces, cfg->interfaces, sizeof(cfg->interfaces)) ||
+            memcmp(c->ignored, cfg->ignored, sizeof(cfg->ignored))))
+                c->generation = cfg->generation + 1;
+        else if (cfg)
+                c->generation = cfg->generation;
+        snprintf(name, sizeof(name), "netdev%u", c->generation);
+        if (piled_add_source(p, name, names, NSOURCES + NALARMS, NALARMS, sample, c) < 0) {
+                free(c);
+                return -1;
         }
 
-        /* We catch these signals so we can clean up */
-        {
-                struct sigaction action;
-                memset(&action, 0, sizeof(action));
-                action.sa_handler = shutdown;
-                sigemptyset(&action.sa_mask);
-                action.sa_flags = 0; /* We block on usleep; don't use SA_RESTART */
-                sigaction(SIGHUP, &action, NULL);
-                sigaction(SIGINT, &action, NULL);
-                sigaction(SIGTERM, &action, NULL);
-        }
+        free(pending);
+        pending = c;
+        return gpioled_build(p, s);
+}
 
-        /* Loop until signal received */
-        while (running) {
-                int a;
-                if (nanosleep(&delay, NULL) < 0)
-                        break;
-                a = activity(netdevices);
-                if (a < 0)
-                        break;
-                led(a);
+/* Switch to the settings of the graph built last, or drop them */
+static void commit(int ok) {
+        if (ok) {
+                free(cfg);
+                cfg = pending;
+        } else {
+                free(pending);
         }
+        pending = NULL;
+}
 
-        /* Ensure the LED is off */
-        led(LOW);
-
-        status = EXIT_SUCCESS;
-
-out:
+/* Close the files */
+static void cleanup(void) {
+        free(cfg);
+        cfg = NULL;
         if (line) free(line);
         if (netdevices) fclose(netdevices);
-        return status;
 }
 
+int main(int argc, char **argv) {
+        static struct argp_option options[] = {
+                { "pin",     'p',     "VALUE", 0, "GPIO pin where LED is connected (default: wiringPi pin 11, physical pin 25 on the P1 header)" },
+                { "alarm",   'a',       "PIN", OPTION_ARG_OPTIONAL, "Blink a code on network errors and drops, on the LED or on its own GPIO pin" },
+                { 0 },
+        };
+        static const struct argp parser = {
+                options, gpioled_parse, NULL, NULL,
+                NULL, NULL, NULL
+        };
+        static const struct piled_program program = {
+                "Show network activity using an LED wired to a GPIO pin.",
+                &parser, defaults, setting, build, commit, cleanup
+        };
+
+        gpioled_init(11);
+        return piled_main(&program, argc, argv);
+}
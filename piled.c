@@ -0,0 +1,1191 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ *
+ **************************************************************************
+ *
+ * libpiled - the core of hddledPi, netledPi and actledPi. See piled.h.
+ *
+ * To build as a library:
+ *   gcc -Wall -O3 -shared -fPIC -o libpiled.so piled.c -ldl -lpthread
+ *
+ * Options of piled_main(), on top of the program's own:
+ * -d, --detach               Detach from terminal (become a daemon)
+ * -r, --refresh=VALUE        Refresh interval (default: 20 ms)
+ * -c, --config=FILE          Read the settings from a config file, reread on SIGHUP
+ * -P, --plugin=FILE[:ARG]    Load a source or sink plugin; may be repeated
+ *     --record=FILE          Record the counters to a trace file
+ *     --replay=FILE          Drive the LEDs from a recorded trace instead of the live counters
+ * -s, --speed=FACTOR         Replay speed (default: 1, real time; 0: as fast as possible)
+ *     --no-led               Don't drive the LED, only the sinks of the plugins
+ *
+ * Config file - one "key = value" setting per line, # starts a comment.
+ * Settings in the config file take precedence over the command-line.
+ *   refresh = VALUE          Refresh interval in ms
+ *   threshold = VALUE        Minimum change of the counters to light the LED (default: 1)
+ *   mode = normal|inverted   Light the LED on activity, or turn it off on activity
+ *   alarm = off|led          Blink a code on errors
+ * plus the settings of the program. Send SIGHUP to reread the config file.
+ * A new graph is built for the new settings, and switched to between two
+ * refreshes; see piled_takeover().
+ */
+
+
+/*
+ * Trace file format: a header of TRACE_MAGIC, a version byte, the number of
+ * counters per tick and how many of those, at the end, are error counters,
+ * followed by one record per tick. A record is the timestamp (microseconds,
+ * CLOCK_MONOTONIC) and each counter, all stored as LEB128 varints of the
+ * difference to the previous record. The counter differences are zigzag
+ * encoded, as counters may go backwards on a reset.
+ *
+ * The ticks append their records to one of two buffers; a writer thread
+ * writes out the other, so a slow disk doesn't hold up the LEDs.
+ */
+#define TRACE_MAGIC "PLTR"
+#define TRACE_VERSION 2
+#define TRACE_MAXRECORD (10 * (1 + PILED_MAXCOUNTERS))
+#define TRACE_BUFSIZE 65536
+#define TRACE_FLUSH 1000000 /* microseconds */
+
+/*
+ * Alarm blink code: three short flashes and a pause, as on and off times in
+ * milliseconds. It is shown for ALARM_HOLD ms after an error counter went up.
+ */
+#define ALARM_HOLD 3000
+
+#define MAXPLUGINS 8
+#define MAXKEY (2 * PILED_MAXNAME)
+
+#define OPT_RECORD 0x100
+#define OPT_REPLAY 0x101
+#define OPT_NOLED 0x102
+
+
+#define _GNU_SOURCE
+
+#include <argp.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "piled.h"
+
+
+struct source {
+        char name[PILED_MAXNAME];
+        char counters[PILED_MAXCOUNTERS][PILED_MAXNAME];
+        unsigned int ncounters;
+        unsigned int nerrors;
+        piled_sample_fn sample;
+        void *arg;
+        int plugin;
+};
+
+struct sink {
+        char name[PILED_MAXNAME];
+        int kind;
+        piled_set_fn set;
+        void *arg;
+        int current;
+        int plugin;
+};
+
+struct trace {
+        int fd;                 /* recording */
+        FILE *file;             /* replaying */
+        unsigned char bufs[2][TRACE_BUFSIZE];
+        unsigned char *buf;     /* filled by the ticks */
+        size_t used;
+        unsigned char *out;     /* written by the writer thread */
+        size_t pending;
+        uint64_t flushed;
+        pthread_t writer;
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        int started, stop, failed;
+        uint64_t prev[1 + PILED_MAXCOUNTERS];
+        unsigned int ncounters;
+        unsigned int nerrors;
+        double speed;
+        uint64_t start, first;
+        unsigned long ticks;
+};
+
+struct piled {
+        struct source sources[PILED_MAXSOURCES];
+        unsigned int nsources;
+        struct sink sinks[PILED_MAXSINKS];
+        unsigned int nsinks;
+
+        /* Activity counters, then error counters, of all the sources */
+        char keys[PILED_MAXCOUNTERS][MAXKEY];
+        uint64_t baseline[PILED_MAXCOUNTERS];
+        unsigned int nactivity;
+        unsigned int nerrors;
+        int primed;
+
+        unsigned int threshold;
+        int mode;
+        int alarm;
+        uint64_t alarm_start, alarm_until;
+
+        struct trace *record;
+        struct trace *replay;
+
+        void *plugins[MAXPLUGINS];
+        unsigned int nplugins;
+        int loading;
+};
+
+/* The sources and sinks of a graph, to undo adding to it */
+struct layout {
+        unsigned int nsources;
+        unsigned int nsinks;
+        unsigned int nactivity;
+        unsigned int nerrors;
+        char keys[PILED_MAXCOUNTERS][MAXKEY];
+};
+
+static volatile sig_atomic_t running = 1;
+static volatile sig_atomic_t reload = 0;
+
+/* Current time in microseconds */
+static uint64_t now_usec(void) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* Write a buffer of trace records to the trace file */
+static int trace_write(int fd, const unsigned char *buf, size_t len) {
+        size_t done = 0;
+
+        while (done < len) {
+                ssize_t written = write(fd, buf + done, len - done);
+                if (written < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        perror("Could not write to trace file");
+                        return -1;
+                }
+                done += written;
+        }
+        return 0;
+}
+
+/* The writer thread: write out each buffer handed over by trace_swap() */
+static void *trace_writer(void *arg) {
+        struct trace *t = arg;
+        int result;
+
+        pthread_mutex_lock(&t->lock);
+        for (;;) {
+                while (!t->pending && !t->stop)
+                        pthread_cond_wait(&t->cond, &t->lock);
+                if (!t->pending)
+                        break;
+                pthread_mutex_unlock(&t->lock);
+                result = trace_write(t->fd, t->out, t->pending);
+                pthread_mutex_lock(&t->lock);
+                if (result < 0)
+                        t->failed = 1;
+                t->pending = 0;
+                pthread_cond_broadcast(&t->cond);
+        }
+        pthread_mutex_unlock(&t->lock);
+        return NULL;
+}
+
+/* Hand the filled buffer over to the writer thread, starting it on first use.
+ * Only waits for the writer when it is still busy and the buffer is full. */
+static int trace_swap(struct trace *t, uint64_t timestamp) {
+        unsigned char *filled;
+        int result;
+
+        if (!t->started) {
+                sigset_t all, old;
+
+                /* The signals are for the main loop */
+                sigfillset(&all);
+                pthread_sigmask(SIG_SETMASK, &all, &old);
+                t->stop = 0;
+                result = pthread_create(&t->writer, NULL, trace_writer, t);
+                pthread_sigmask(SIG_SETMASK, &old, NULL);
+                if (result) {
+                        errno = result;
+                        perror("Could not start trace writer");
+                        return -1;
+                }
+                t->started = 1;
+        }
+
+        pthread_mutex_lock(&t->lock);
+        if (t->used + TRACE_MAXRECORD > TRACE_BUFSIZE)
+                while (t->pending)
+                        pthread_cond_wait(&t->cond, &t->lock);
+        if (!t->pending) {
+                filled = t->buf;
+                t->buf = t->out;
+                t->out = filled;
+                t->pending = t->used;
+                t->used = 0;
+                t->flushed = timestamp;
+                pthread_cond_broadcast(&t->cond);
+        }
+        result = t->failed ? -1 : 0;
+        pthread_mutex_unlock(&t->lock);
+        return result;
+}
+
+/* Stop the writer thread, and write out all the buffered trace records.
+ * Done before forking too, as the thread doesn't survive a fork. */
+static int trace_flush(struct trace *t) {
+        int result = 0;
+
+        if (t->started) {
+                pthread_mutex_lock(&t->lock);
+                t->stop = 1;
+                pthread_cond_broadcast(&t->cond);
+                pthread_mutex_unlock(&t->lock);
+                pthread_join(t->writer, NULL);
+                t->started = 0;
+        }
+        if (t->failed || trace_write(t->fd, t->buf, t->used) < 0)
+                result = -1;
+        t->used = 0;
+        t->flushed = now_usec();
+        return result;
+}
+
+/* Append a varint to the trace buffer */
+static void trace_put(struct trace *t, uint64_t value) {
+        while (value >= 0x80) {
+                t->buf[t->used++] = (value & 0x7f) | 0x80;
+                value >>= 7;
+        }
+        t->buf[t->used++] = value;
+}
+
+/* Append one tick to the trace, handing the buffer over when it is full or stale */
+static int trace_record(struct trace *t, uint64_t timestamp, const uint64_t *values) {
+        unsigned int i;
+
+        trace_put(t, timestamp - t->prev[0]);
+        t->prev[0] = timestamp;
+        for (i = 0; i < t->ncounters; i++) {
+                int64_t delta = values[i] - t->prev[i + 1];
+                trace_put(t, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+                t->prev[i + 1] = values[i];
+        }
+
+        if (t->used + TRACE_MAXRECORD > TRACE_BUFSIZE ||
+            timestamp - t->flushed >= TRACE_FLUSH)
+                return trace_swap(t, timestamp);
+        return 0;
+}
+
+/* Read a varint from the trace file */
+static int trace_get(FILE *trace, uint64_t *value) {
+        int shift = 0;
+        int c;
+
+        *value = 0;
+        do {
+                c = getc(trace);
+                if (c == EOF || shift > 63)
+                        return -1;
+                *value |= (uint64_t)(c & 0x7f) << shift;
+                shift += 7;
+        } while (c & 0x80);
+        return 0;
+}
+
+/* Read one tick from the trace; returns 0 at the end of the trace */
+static int trace_replay(struct trace *t, uint64_t *timestamp, uint64_t *values) {
+        uint64_t delta;
+        unsigned int i;
+        int c;
+
+        c = getc(t->file);
+        if (c == EOF)
+                return 0;
+        ungetc(c, t->file);
+
+        if (trace_get(t->file, &delta) < 0)
+                goto truncated;
+        t->prev[0] += delta;
+        *timestamp = t->prev[0];
+        for (i = 0; i < t->ncounters; i++) {
+                if (trace_get(t->file, &delta) < 0)
+                        goto truncated;
+                t->prev[i + 1] += (delta >> 1) ^ -(delta & 1);
+                values[i] = t->prev[i + 1];
+        }
+        return 1;
+
+truncated:
+        fprintf(stderr, "Truncated trace file\n");
+        return -1;
+}
+
+/* Wait until a replayed tick is due */
+static int trace_pace(struct trace *t, uint64_t timestamp) {
+        uint64_t due = t->start + (timestamp - t->first) / t->speed;
+        struct timespec until;
+        int result;
+
+        until.tv_sec = due / 1000000;
+        until.tv_nsec = 1000 * (due % 1000000);
+        do {
+                result = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+        } while (result == EINTR && running);
+        return result ? -1 : 0;
+}
+
+/* Close a trace file, writing out what is still buffered */
+static void trace_close(struct trace *t) {
+        if (t->fd >= 0) {
+                trace_flush(t);
+                close(t->fd);
+                pthread_mutex_destroy(&t->lock);
+                pthread_cond_destroy(&t->cond);
+        }
+        if (t->file)
+                fclose(t->file);
+        free(t);
+}
+
+/* Remember the sources and sinks of a graph */
+static void save_layout(const struct piled *p, struct layout *l) {
+        l->nsources = p->nsources;
+        l->nsinks = p->nsinks;
+        l->nactivity = p->nactivity;
+        l->nerrors = p->nerrors;
+        memcpy(l->keys, p->keys, sizeof(l->keys));
+}
+
+/* Drop the sources and sinks added since save_layout() */
+static void restore_layout(struct piled *p, const struct layout *l) {
+        p->nsources = l->nsources;
+        p->nsinks = l->nsinks;
+        p->nactivity = l->nactivity;
+        p->nerrors = l->nerrors;
+        memcpy(p->keys, l->keys, sizeof(p->keys));
+}
+
+/* Is the alarm blink code on at this time? */
+static int blink_code(uint64_t elapsed) {
+        static const unsigned int code[] = { 100, 150, 100, 150, 100, 800 };
+        unsigned int cycle = 0, i;
+
+        for (i = 0; i < sizeof(code) / sizeof(code[0]); i++)
+                cycle += code[i];
+        elapsed %= cycle;
+        for (i = 0; elapsed >= code[i]; i++)
+                elapsed -= code[i];
+        return !(i & 1);
+}
+
+/* Update the LED of a sink */
+static void sink_set(struct sink *s, int on) {
+        if (s->current == on)
+                return;
+
+        s->set(s->arg, on);
+        s->current = on;
+}
+
+/* Sample all the sources, sorting their activity and error counters */
+static int gather(struct piled *p, uint64_t *values) {
+        uint64_t sample[PILED_MAXCOUNTERS];
+        unsigned int activity = 0, errors = p->nactivity;
+        unsigned int i, j;
+
+        for (i = 0; i < p->nsources; i++) {
+                struct source *s = &p->sources[i];
+                if (s->sample(s->arg, sample) < 0)
+                        return -1;
+                for (j = 0; j < s->ncounters - s->nerrors; j++)
+                        values[activity++] = sample[j];
+                for (; j < s->ncounters; j++)
+                        values[errors++] = sample[j];
+        }
+        return 0;
+}
+
+/* Compare the counters with the previous tick, and update the LEDs; now is
+ * the time of the sample, from the clock or the trace being replayed */
+static void update(struct piled *p, uint64_t now, const uint64_t *values,
+                   unsigned int nactivity, unsigned int nerrors) {
+        uint64_t change = 0;
+        int a, raised = 0, alarm, code, alarm_sinks = 0;
+        unsigned int i;
+
+        for (i = 0; i < nactivity; i++) {
+                if (values[i] > p->baseline[i])
+                        change += values[i] - p->baseline[i];
+                else
+                        change += p->baseline[i] - values[i];
+        }
+        for (; i < nactivity + nerrors; i++) {
+                if (values[i] > p->baseline[i])
+                        raised = 1;
+        }
+        memcpy(p->baseline, values, (nactivity + nerrors) * sizeof(values[0]));
+
+        /* The first tick only saves the counter values */
+        if (!p->primed) {
+                p->primed = 1;
+                return;
+        }
+
+        a = change >= p->threshold;
+        if (p->mode == PILED_MODE_INVERTED)
+                a = !a;
+
+        /* Raise the alarm if an error counter went up */
+        if (raised) {
+                if (now >= p->alarm_until)
+                        p->alarm_start = now;
+                p->alarm_until = now + 1000 * ALARM_HOLD;
+        }
+        alarm = p->alarm == PILED_ALARM_ON && now < p->alarm_until;
+        code = alarm && blink_code((now - p->alarm_start) / 1000);
+
+        for (i = 0; i < p->nsinks; i++)
+                if (p->sinks[i].kind == PILED_SINK_ALARM)
+                        alarm_sinks = 1;
+        for (i = 0; i < p->nsinks; i++) {
+                struct sink *s = &p->sinks[i];
+                if (s->kind == PILED_SINK_ALARM)
+                        sink_set(s, code);
+                else
+                        sink_set(s, alarm && !alarm_sinks ? code : a);
+        }
+}
+
+struct piled *piled_new(void) {
+        struct piled *p = calloc(1, sizeof(*p));
+        if (!p)
+                return NULL;
+
+        p->threshold = 1;
+        p->mode = PILED_MODE_NORMAL;
+        p->alarm = PILED_ALARM_OFF;
+        return p;
+}
+
+void piled_free(struct piled *p) {
+        if (!p)
+                return;
+
+        if (p->record)
+                trace_close(p->record);
+        if (p->replay)
+                trace_close(p->replay);
+        while (p->nplugins--) {
+                piled_plugin_exit_fn plugin_exit = (piled_plugin_exit_fn)dlsym(p->plugins[p->nplugins], PILED_PLUGIN_EXIT);
+                if (plugin_exit)
+                        plugin_exit();
+                dlclose(p->plugins[p->nplugins]);
+        }
+        free(p);
+}
+
+int piled_add_source(struct piled *p, const char *name, const char *const *counters,
+                     unsigned int ncounters, unsigned int nerrors,
+                     piled_sample_fn sample, void *arg) {
+        struct source *s;
+        char key[MAXKEY];
+        unsigned int i, k;
+
+        if (p->nsources == PILED_MAXSOURCES ||
+            p->nactivity + p->nerrors + ncounters > PILED_MAXCOUNTERS ||
+            nerrors > ncounters || !ncounters) {
+                fprintf(stderr, "Could not add source %s: too many sources or counters\n", name);
+                return -1;
+        }
+
+        s = &p->sources[p->nsources++];
+        snprintf(s->name, sizeof(s->name), "%s", name);
+        for (i = 0; i < ncounters; i++) {
+                if (counters)
+                        snprintf(s->counters[i], sizeof(s->counters[i]), "%s", counters[i]);
+                else
+                        snprintf(s->counters[i], sizeof(s->counters[i]), "%u", i);
+        }
+        s->ncounters = ncounters;
+        s->nerrors = nerrors;
+        s->sample = sample;
+        s->arg = arg;
+        s->plugin = p->loading;
+
+        /* Keep the keys in the same order as gather() puts the counters */
+        memmove(p->keys[p->nactivity + ncounters - nerrors], p->keys[p->nactivity],
+                p->nerrors * sizeof(p->keys[0]));
+        for (i = 0; i < ncounters; i++) {
+                k = i < ncounters - nerrors ? p->nactivity + i : p->nactivity + p->nerrors + i;
+                snprintf(key, sizeof(key), "%s/%s", s->name, s->counters[i]);
+                memcpy(p->keys[k], key, sizeof(key));
+        }
+        p->nactivity += ncounters - nerrors;
+        p->nerrors += nerrors;
+        return 0;
+}
+
+int piled_add_sink(struct piled *p, const char *name, int kind, piled_set_fn set, void *arg) {
+        struct sink *s;
+
+        if (p->nsinks == PILED_MAXSINKS) {
+                fprintf(stderr, "Could not add sink %s: too many sinks\n", name);
+                return -1;
+        }
+
+        s = &p->sinks[p->nsinks++];
+        snprintf(s->name, sizeof(s->name), "%s", name);
+        s->kind = kind;
+        s->set = set;
+        s->arg = arg;
+        s->current = -1; /* Ensure the LED is set on first call */
+        s->plugin = p->loading;
+        return 0;
+}
+
+void piled_set_threshold(struct piled *p, unsigned int threshold) {
+        p->threshold = threshold;
+}
+
+void piled_set_mode(struct piled *p, int mode) {
+        p->mode = mode;
+}
+
+void piled_set_alarm(struct piled *p, int alarm) {
+        p->alarm = alarm;
+}
+
+int piled_tick(struct piled *p) {
+        uint64_t values[PILED_MAXCOUNTERS];
+        uint64_t timestamp;
+        int result;
+
+        if (p->replay) {
+                struct trace *t = p->replay;
+                result = trace_replay(t, &timestamp, values);
+                if (result <= 0)
+                        return result < 0 ? -1 : PILED_END;
+                if (!p->primed) {
+                        t->start = now_usec();
+                        t->first = timestamp;
+                } else {
+                        if (t->speed > 0 && trace_pace(t, timestamp) < 0)
+                                return -1;
+                        t->ticks++;
+                }
+                update(p, timestamp, values, t->ncounters - t->nerrors, t->nerrors);
+                return 0;
+        }
+
+        if (gather(p, values) < 0)
+                return -1;
+        timestamp = now_usec();
+        if (p->record && trace_record(p->record, timestamp, values) < 0)
+                return -1;
+        update(p, timestamp, values, p->nactivity, p->nerrors);
+        return 0;
+}
+
+void piled_off(struct piled *p) {
+        unsigned int i;
+
+        for (i = 0; i < p->nsinks; i++)
+                sink_set(&p->sinks[i], 0);
+}
+
+int piled_record(struct piled *p, const char *path) {
+        struct trace *t = calloc(1, sizeof(*t));
+        if (!t) {
+                perror("Could not record trace");
+                return -1;
+        }
+
+        t->file = NULL;
+        t->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (t->fd < 0) {
+                perror("Could not open trace file for writing");
+                free(t);
+                return -1;
+        }
+        t->buf = t->bufs[0];
+        t->out = t->bufs[1];
+        pthread_mutex_init(&t->lock, NULL);
+        pthread_cond_init(&t->cond, NULL);
+        t->ncounters = p->nactivity + p->nerrors;
+        t->nerrors = p->nerrors;
+
+        memcpy(t->buf, TRACE_MAGIC, 4);
+        t->buf[4] = TRACE_VERSION;
+        t->buf[5] = t->ncounters;
+        t->buf[6] = t->nerrors;
+        t->used = 7;
+        if (p->record)
+                trace_close(p->record);
+        p->record = t;
+        return trace_flush(t);
+}
+
+int piled_replay(struct piled *p, const char *path, double speed) {
+        unsigned char header[7];
+        struct trace *t = calloc(1, sizeof(*t));
+        if (!t) {
+                perror("Could not replay trace");
+                return -1;
+        }
+
+        t->fd = -1;
+        t->speed = speed;
+        t->file = fopen(path, "r");
+        if (!t->file) {
+                perror("Could not open trace file for reading");
+                free(t);
+                return -1;
+        }
+
+        /* Version 1 traces have no error counters, and no byte for their number */
+        if (fread(header, 1, 6, t->file) != 6 || memcmp(header, TRACE_MAGIC, 4) ||
+            header[4] < 1 || header[4] > TRACE_VERSION ||
+            (header[4] > 1 && fread(header + 6, 1, 1, t->file) != 1)) {
+                fprintf(stderr, "Not a trace file: %s\n", path);
+                trace_close(t);
+                return -1;
+        }
+        t->ncounters = header[5];
+        t->nerrors = header[4] > 1 ? header[6] : 0;
+        if (t->ncounters < 1 || t->ncounters > PILED_MAXCOUNTERS || t->nerrors >= t->ncounters) {
+                fprintf(stderr, "Unsupported number of counters in trace file: %u\n", t->ncounters);
+                trace_close(t);
+                return -1;
+        }
+
+        if (p->replay)
+                trace_close(p->replay);
+        p->replay = t;
+        return 0;
+}
+
+int piled_load_plugin(struct piled *p, const char *spec) {
+        piled_plugin_init_fn plugin_init;
+        piled_plugin_exit_fn plugin_exit;
+        const unsigned int *version;
+        struct layout layout;
+        char path[4096];
+        const char *arg;
+        void *handle;
+        int result;
+
+        if (p->nplugins == MAXPLUGINS) {
+                fprintf(stderr, "Could not load %s: too many plugins\n", spec);
+                return -1;
+        }
+
+        arg = strchr(spec, ':');
+        snprintf(path, sizeof(path), "%.*s", arg ? (int)(arg - spec) : (int)strlen(spec), spec);
+        if (arg)
+                arg++;
+
+        handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+        if (!handle) {
+                fprintf(stderr, "Could not load plugin: %s\n", dlerror());
+                return -1;
+        }
+        plugin_init = (piled_plugin_init_fn)dlsym(handle, PILED_PLUGIN_INIT);
+        version = (const unsigned int *)dlsym(handle, PILED_PLUGIN_VERSION);
+        if (!plugin_init || !version) {
+                fprintf(stderr, "Not a plugin: %s\n", path);
+                dlclose(handle);
+                return -1;
+        }
+        if (*version != PILED_API_VERSION) {
+                fprintf(stderr, "Plugin %s was built for API version %u, not %u\n",
+                        path, *version, PILED_API_VERSION);
+                dlclose(handle);
+                return -1;
+        }
+
+        /* Don't leave sources and sinks behind that point into the unloaded plugin */
+        save_layout(p, &layout);
+        p->loading = 1;
+        result = plugin_init(p, arg);
+        p->loading = 0;
+        if (result < 0) {
+                fprintf(stderr, "Could not initialise plugin %s\n", path);
+                restore_layout(p, &layout);
+                plugin_exit = (piled_plugin_exit_fn)dlsym(handle, PILED_PLUGIN_EXIT);
+                if (plugin_exit)
+                        plugin_exit();
+                dlclose(handle);
+                return -1;
+        }
+
+        p->plugins[p->nplugins++] = handle;
+        return 0;
+}
+
+int piled_takeover(struct piled *next, struct piled *prev) {
+        uint64_t values[PILED_MAXCOUNTERS];
+        const char *counters[PILED_MAXCOUNTERS];
+        struct layout layout;
+        unsigned int i, j;
+
+        save_layout(next, &layout);
+
+        /* The sources and sinks of the plugins stay */
+        for (i = 0; i < prev->nsources; i++) {
+                struct source *s = &prev->sources[i];
+                if (!s->plugin)
+                        continue;
+                for (j = 0; j < s->ncounters; j++)
+                        counters[j] = s->counters[j];
+                next->loading = 1;
+                j = piled_add_source(next, s->name, counters, s->ncounters, s->nerrors, s->sample, s->arg);
+                next->loading = 0;
+                if (j)
+                        goto undo;
+        }
+        for (i = 0; i < prev->nsinks; i++) {
+                struct sink *s = &prev->sinks[i];
+                if (!s->plugin)
+                        continue;
+                next->loading = 1;
+                j = piled_add_sink(next, s->name, s->kind, s->set, s->arg);
+                next->loading = 0;
+                if (j)
+                        goto undo;
+        }
+
+        /* The trace has no room for counters that mean something else */
+        if (prev->record) {
+                j = next->nactivity != prev->nactivity || next->nerrors != prev->nerrors;
+                for (i = 0; !j && i < next->nactivity + next->nerrors; i++)
+                        j = strcmp(next->keys[i], prev->keys[i]);
+                if (j) {
+                        fprintf(stderr, "Cannot change the counters while recording\n");
+                        goto undo;
+                }
+        }
+
+        /* Counters that are still there keep their previous values */
+        if (prev->replay) {
+                memcpy(values, prev->baseline, sizeof(values));
+        } else {
+                if (gather(next, values) < 0)
+                        goto undo;
+                for (i = 0; i < next->nactivity + next->nerrors; i++) {
+                        for (j = 0; j < prev->nactivity + prev->nerrors; j++) {
+                                if (!strcmp(next->keys[i], prev->keys[j])) {
+                                        values[i] = prev->baseline[j];
+                                        break;
+                                }
+                        }
+                }
+        }
+        memcpy(next->baseline, values, sizeof(values));
+        next->primed = prev->primed;
+
+        /* Sinks that are still there keep their LED state, those that are gone turn off */
+        for (i = 0; i < prev->nsinks; i++) {
+                for (j = 0; j < next->nsinks; j++) {
+                        if (!strcmp(next->sinks[j].name, prev->sinks[i].name)) {
+                                next->sinks[j].current = prev->sinks[i].current;
+                                break;
+                        }
+                }
+                if (j == next->nsinks)
+                        sink_set(&prev->sinks[i], 0);
+        }
+        for (j = 0; j < next->nsinks; j++)
+                if (next->sinks[j].current < 0)
+                        sink_set(&next->sinks[j], 0);
+
+        next->alarm_start = prev->alarm_start;
+        next->alarm_until = prev->alarm_until;
+        next->record = prev->record;
+        next->replay = prev->replay;
+        prev->record = prev->replay = NULL;
+        memcpy(next->plugins, prev->plugins, sizeof(prev->plugins));
+        next->nplugins = prev->nplugins;
+        prev->nplugins = 0;
+        return 0;
+
+undo:
+        restore_layout(next, &layout);
+        return -1;
+}
+
+int piled_number(const char *value, unsigned int *result) {
+        char *end;
+
+        errno = 0;
+        *result = strtoul(value, &end, 10);
+        return (!*value || *end || *value == '-' || errno) ? -1 : 0;
+}
+
+
+static struct piled_settings o_settings = { 20, 1, PILED_MODE_NORMAL, PILED_ALARM_OFF, 1 };
+static int o_detach = 0;
+static char *o_config = NULL;
+static char *o_record = NULL;
+static char *o_replay = NULL;
+static double o_speed = 1.0;
+static char *o_plugins[MAXPLUGINS];
+static unsigned int o_nplugins = 0;
+
+/* Strip leading and trailing whitespace */
+static char *trim(char *s) {
+        char *end;
+
+        s += strspn(s, " \t");
+        end = s + strlen(s);
+        while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+                end--;
+        *end = '\0';
+        return s;
+}
+
+/* Read the config file, if any, on top of the command-line settings; at
+ * startup, a config file that doesn't exist yet is skipped */
+static int load_settings(const struct piled_program *prog, const char *path,
+                         struct piled_settings *s, int startup) {
+        FILE *file;
+        char *buf = NULL;
+        size_t size = 0;
+        unsigned int lineno = 0;
+        int result = 0;
+
+        *s = o_settings;
+        prog->defaults();
+        if (!path)
+                return 0;
+
+        file = fopen(path, "r");
+        if (!file && errno == ENOENT && startup) {
+                fprintf(stderr, "No config file %s, using the command-line settings until SIGHUP\n", path);
+                return 0;
+        }
+        if (!file) {
+                fprintf(stderr, "Could not open %s for reading: %s\n", path, strerror(errno));
+                return -1;
+        }
+
+        while (result == 0 && getline(&buf, &size, file) != -1) {
+                const char *error = NULL;
+                char *key, *value;
+
+                lineno++;
+                buf[strcspn(buf, "#\n")] = '\0';
+                key = trim(buf);
+                if (!*key)
+                        continue;
+                value = strchr(key, '=');
+                if (!value) {
+                        error = "expected \"key = value\"";
+                } else {
+                        *value++ = '\0';
+                        key = trim(key);
+                        value = trim(value);
+                }
+
+                if (error || prog->setting(s, key, value, &error) <= 0) {
+                        /* The program's own setting, or already complained */
+                } else if (!strcmp(key, "refresh")) {
+                        if (piled_number(value, &s->refresh) || s->refresh < 10)
+                                error = "refresh interval must be at least 10";
+                } else if (!strcmp(key, "threshold")) {
+                        if (piled_number(value, &s->threshold) || s->threshold < 1)
+                                error = "threshold must be at least 1";
+                } else if (!strcmp(key, "mode")) {
+                        if (!strcmp(value, "normal"))
+                                s->mode = PILED_MODE_NORMAL;
+                        else if (!strcmp(value, "inverted"))
+                                s->mode = PILED_MODE_INVERTED;
+                        else
+                                error = "mode must be normal or inverted";
+                } else if (!strcmp(key, "alarm")) {
+                        if (!strcmp(value, "off"))
+                                s->alarm = PILED_ALARM_OFF;
+                        else if (!strcmp(value, "led"))
+                                s->alarm = PILED_ALARM_ON;
+                        else
+                                error = "alarm must be off or led";
+                } else {
+                        error = "unknown setting";
+                }
+
+                if (error) {
+                        fprintf(stderr, "%s:%u: %s\n", path, lineno, error);
+                        result = -1;
+                }
+        }
+
+        free(buf);
+        fclose(file);
+        return result;
+}
+
+/* Build a graph for the settings */
+static struct piled *build(const struct piled_program *prog, const struct piled_settings *s) {
+        struct piled *p = piled_new();
+        if (!p) {
+                perror("Could not create graph");
+                return NULL;
+        }
+
+        piled_set_threshold(p, s->threshold);
+        piled_set_mode(p, s->mode);
+        piled_set_alarm(p, s->alarm);
+        if (prog->build(p, s) < 0) {
+                piled_free(p);
+                return NULL;
+        }
+        return p;
+}
+
+/* Reread the config file and switch to a graph for it between two refreshes */
+static struct piled *reconfigure(const struct piled_program *prog, struct piled *p, struct piled_settings *s) {
+        struct piled_settings new;
+        struct piled *next;
+
+        if (load_settings(prog, o_config, &new, 0) < 0)
+                goto keep;
+
+        next = build(prog, &new);
+        if (!next) {
+                prog->commit(0);
+                goto keep;
+        }
+        if (piled_takeover(next, p) < 0) {
+                piled_free(next);
+                prog->commit(0);
+                goto keep;
+        }
+
+        piled_free(p);
+        prog->commit(1);
+        *s = new;
+        return next;
+
+keep:
+        fprintf(stderr, "Keeping the current configuration\n");
+        return p;
+}
+
+/* Signal handler -- break out of the main loop */
+static void shutdown(int sig) {
+        running = 0;
+}
+
+/* Signal handler -- reread the config file */
+static void hangup(int sig) {
+        reload = 1;
+}
+
+/* Argp parser function */
+static error_t parse_options(int key, char *arg, struct argp_state *state) {
+        switch (key) {
+        case ARGP_KEY_INIT:
+                state->child_inputs[0] = &o_settings;
+                break;
+        case 'd':
+                o_detach = 1;
+                break;
+        case 'r':
+                o_settings.refresh = strtol(arg, NULL, 10);
+                if (o_settings.refresh < 10)
+                        argp_failure(state, EXIT_FAILURE, 0,
+                                "refresh interval must be at least 10");
+                break;
+        case 'c':
+                o_config = arg;
+                break;
+        case 'P':
+                if (o_nplugins == MAXPLUGINS)
+                        argp_failure(state, EXIT_FAILURE, 0,
+                                "too many plugins");
+                o_plugins[o_nplugins++] = arg;
+                break;
+        case 's':
+                o_speed = strtod(arg, NULL);
+                if (o_speed < 0)
+                        argp_failure(state, EXIT_FAILURE, 0,
+                                "replay speed must not be negative");
+                break;
+        case OPT_RECORD:
+                o_record = arg;
+                break;
+        case OPT_REPLAY:
+                o_replay = arg;
+                break;
+        case OPT_NOLED:
+                o_settings.leds = 0;
+                break;
+        case ARGP_KEY_END:
+                if (o_record && o_replay)
+                        argp_failure(state, EXIT_FAILURE, 0,
+                                "cannot record and replay at the same time");
+                break;
+        default:
+                return ARGP_ERR_UNKNOWN;
+        }
+        return 0;
+}
+
+int piled_main(const struct piled_program *prog, int argc, char **argv) {
+        struct argp_option options[] = {
+                { "detach",  'd',        NULL, 0, "Detach from terminal" },
+                { "refresh", 'r',     "VALUE", 0, "Refresh interval (default: 20 ms)" },
+                { "config",  'c',      "FILE", 0, "Read the settings from a config file, reread on SIGHUP" },
+                { "plugin",  'P',  "FILE[:ARG]", 0, "Load a source or sink plugin; may be repeated" },
+                { "record",  OPT_RECORD, "FILE", 0, "Record the counters to a trace file" },
+                { "replay",  OPT_REPLAY, "FILE", 0, "Drive the LED from a recorded trace instead of the live counters" },
+                { "speed",   's',    "FACTOR", 0, "Replay speed (default: 1, real time; 0: as fast as possible)" },
+                { "no-led",  OPT_NOLED,  NULL, 0, "Don't drive the LED, only the sinks of the plugins" },
+                { 0 },
+        };
+        struct argp_child children[] = {
+                { prog->argp, 0, NULL, 0 },
+                { 0 },
+        };
+        struct argp parser = {
+                options, parse_options, NULL,
+                prog->doc,
+                children, NULL, NULL
+        };
+        int status = EXIT_FAILURE;
+        struct piled_settings settings;
+        struct piled *p = NULL;
+        struct timespec delay;
+        unsigned int i;
+
+        /* Parse the command-line */
+        if (argp_parse(&parser, argc, argv, ARGP_NO_ARGS, NULL, NULL))
+                goto out;
+
+        /* Read the config file, and set up the sources and sinks */
+        if (load_settings(prog, o_config, &settings, 1) < 0)
+                goto out;
+        p = build(prog, &settings);
+        prog->commit(p != NULL);
+        if (!p)
+                goto out;
+        for (i = 0; i < o_nplugins; i++)
+                if (piled_load_plugin(p, o_plugins[i]) < 0)
+                        goto out;
+
+        if (o_replay && piled_replay(p, o_replay, o_speed) < 0)
+                goto out;
+        if (o_record && piled_record(p, o_record) < 0)
+                goto out;
+
+        /* Ensure the LEDs are off */
+        piled_off(p);
+
+        /* Save the current counter values */
+        if (piled_tick(p) != 0)
+                goto out;
+
+        /* Don't leave buffered records for both processes to write, nor the
+         * writer thread behind in the parent */
+        if (p->record && trace_flush(p->record) < 0)
+                goto out;
+
+        /* Detach from terminal? */
+        if (o_detach) {
+                pid_t child = fork();
+                if (child < 0) {
+                        perror("Could not detach from terminal");
+                        goto out;
+                }
+                if (child) {
+                        /* I am the parent; the LEDs and files are the child's now */
+                        return EXIT_SUCCESS;
+                }
+        }
+
+        /* We catch these signals so we can clean up */
+        {
+                struct sigaction action;
+                memset(&action, 0, sizeof(action));
+                action.sa_handler = shutdown;
+                sigemptyset(&action.sa_mask);
+                action.sa_flags = 0; /* We block on usleep; don't use SA_RESTART */
+                sigaction(SIGINT, &action, NULL);
+                sigaction(SIGTERM, &action, NULL);
+                action.sa_handler = hangup;
+                sigaction(SIGHUP, &action, NULL);
+        }
+
+        /* Loop until signal received, or the trace has been replayed */
+        while (running) {
+                if (reload) {
+                        reload = 0;
+                        if (o_config)
+                                p = reconfigure(prog, p, &settings);
+                        else
+                                fprintf(stderr, "Nothing to reload: no config file given with -c\n");
+                }
+                if (!p->replay) {
+                        delay.tv_sec = settings.refresh / 1000;
+                        delay.tv_nsec = 1000000 * (settings.refresh % 1000);
+                        if (nanosleep(&delay, NULL) < 0) {
+                                if (errno == EINTR)
+                                        continue;
+                                break;
+                        }
+                }
+                if (piled_tick(p) != 0)
+                        break;
+        }
+
+        /* Ensure the LEDs are off */
+        piled_off(p);
+
+        if (p->replay)
+                fprintf(stderr, "Replayed %lu ticks in %.3f s\n", p->replay->ticks,
+                        (now_usec() - p->replay->start) / 1e6);
+
+        status = EXIT_SUCCESS;
+
+out:
+        piled_free(p);
+        prog->cleanup();
+        return status;
+}
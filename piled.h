@@ -0,0 +1,193 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ *
+ **************************************************************************
+ *
+ * libpiled - blink LEDs on changes of activity counters.
+ *
+ * A piled graph has sources, which return a set of 64-bit counters when
+ * sampled, and sinks, which turn an LED on or off. Each tick samples all
+ * the sources, and lights the sinks when the counters changed by at least
+ * the threshold since the previous tick. The last counters of a source
+ * can be error counters: when one of those goes up, the alarm blink code
+ * is shown for a few seconds, on the alarm sinks if there are any, or
+ * else instead of the activity.
+ *
+ * A program that already has counters can link piled.c, or libpiled.so:
+ *   gcc -Wall -O3 -shared -fPIC -o libpiled.so piled.c -ldl -lpthread
+ * and call piled_tick() from its own loop. The graph is not thread-safe.
+ *
+ * Plugins are shared objects exporting PILED_PLUGIN_INIT, which is called
+ * once when the plugin is loaded, and may add sources and sinks. They can
+ * also export PILED_PLUGIN_EXIT, called before the plugin is unloaded.
+ * They must state the API version they were built for with
+ * PILED_PLUGIN_DEFINE_VERSION; plugins built for another version are
+ * not loaded.
+ */
+
+#ifndef PILED_H
+#define PILED_H
+
+#include <argp.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PILED_API_VERSION 1
+
+#define PILED_MAXSOURCES 8
+#define PILED_MAXSINKS 8
+#define PILED_MAXCOUNTERS 16    /* in total, over all sources */
+#define PILED_MAXNAME 32
+
+#define PILED_MODE_NORMAL 0
+#define PILED_MODE_INVERTED 1
+
+#define PILED_ALARM_OFF 0
+#define PILED_ALARM_ON 1
+
+#define PILED_SINK_ACTIVITY 0   /* Shows the activity, or the alarm code if there are no alarm sinks */
+#define PILED_SINK_ALARM 1      /* Shows the alarm code only */
+
+#define PILED_END 1             /* piled_tick(): the replayed trace has ended */
+
+#define PILED_PLUGIN_INIT "piled_plugin_init"
+#define PILED_PLUGIN_EXIT "piled_plugin_exit"
+#define PILED_PLUGIN_VERSION "piled_plugin_version"
+
+/* Put this once in a plugin, at file scope */
+#define PILED_PLUGIN_DEFINE_VERSION \
+        const unsigned int piled_plugin_version = PILED_API_VERSION
+
+struct piled;
+
+/* The API version a plugin was built for; declared here so that it has C
+ * linkage, and is exported, in C++ plugins too */
+extern const unsigned int piled_plugin_version;
+
+/* Read the current counters of a source; return 0, or -1 on error */
+typedef int (*piled_sample_fn)(void *arg, uint64_t *values);
+
+/* Turn the LED of a sink on or off */
+typedef void (*piled_set_fn)(void *arg, int on);
+
+/* Plugin entry points */
+typedef int (*piled_plugin_init_fn)(struct piled *p, const char *arg);
+typedef void (*piled_plugin_exit_fn)(void);
+
+/* Create an empty graph; returns NULL when out of memory */
+struct piled *piled_new(void);
+
+/* Free a graph, closing its trace files and unloading its plugins */
+void piled_free(struct piled *p);
+
+/*
+ * Add a source with ncounters counters, the last nerrors of which are error
+ * counters. counters names them (or is NULL); piled_takeover() uses the
+ * source and counter names to carry the previous values over. Returns 0, or
+ * -1 when there are too many sources or counters.
+ */
+int piled_add_source(struct piled *p, const char *name, const char *const *counters,
+                     unsigned int ncounters, unsigned int nerrors,
+                     piled_sample_fn sample, void *arg);
+
+/* Add a sink of the given kind; returns 0, or -1 when there are too many */
+int piled_add_sink(struct piled *p, const char *name, int kind, piled_set_fn set, void *arg);
+
+/* Display settings */
+void piled_set_threshold(struct piled *p, unsigned int threshold);
+void piled_set_mode(struct piled *p, int mode);
+void piled_set_alarm(struct piled *p, int alarm);
+
+/*
+ * Sample the sources and update the sinks. The first tick only saves the
+ * counter values. Returns 0, PILED_END at the end of a replayed trace, or
+ * -1 on error.
+ */
+int piled_tick(struct piled *p);
+
+/* Turn all the LEDs off */
+void piled_off(struct piled *p);
+
+/* Write the counters of every tick to a trace file; add the sources first */
+int piled_record(struct piled *p, const char *path);
+
+/* Take the counters from a trace file instead of the sources; speed 0 replays without delay */
+int piled_replay(struct piled *p, const char *path, double speed);
+
+/* Load a plugin, "FILE[:ARG]"; returns 0, or -1 on error */
+int piled_load_plugin(struct piled *p, const char *spec);
+
+/*
+ * Switch from graph prev to graph next between two ticks. next takes over
+ * the counter values of the sources and counters with the same names, the
+ * LED state of the sinks with the same names, the plugins, the alarm and
+ * the trace files. The LEDs of sinks that are gone are turned off. Returns
+ * 0, after which prev only needs piled_free(), or -1 if the new sources
+ * can't be sampled, in which case prev is unchanged.
+ */
+int piled_takeover(struct piled *next, struct piled *prev);
+
+/* Parse a non-negative number; returns 0, or -1 if it isn't one */
+int piled_number(const char *value, unsigned int *result);
+
+/*
+ * The daemon shared by hddledPi, netledPi and actledPi: command-line and
+ * config file parsing, detaching, signal handling and the main loop.
+ */
+struct piled_settings {
+        unsigned int refresh;   /* milliseconds */
+        unsigned int threshold;
+        int mode;
+        int alarm;
+        int leds;               /* 0: don't drive the program's own LEDs (--no-led) */
+};
+
+struct piled_program {
+        const char *doc;
+        /* Options of the program itself; state->input is the struct piled_settings */
+        const struct argp *argp;
+        /* Reset the program's settings to the command-line values */
+        void (*defaults)(void);
+        /* Config file setting; return 0, 1 if the key is unknown, or -1 and set *error */
+        int (*setting)(struct piled_settings *s, const char *key, const char *value, const char **error);
+        /* Add the sources and sinks for the settings; return 0, or -1 on error */
+        int (*build)(struct piled *p, const struct piled_settings *s);
+        /* The graph built last is now in use (ok), or has been dropped */
+        void (*commit)(int ok);
+        /* Release everything before exit */
+        void (*cleanup)(void);
+};
+
+int piled_main(const struct piled_program *prog, int argc, char **argv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PILED_H */
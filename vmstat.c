@@ -0,0 +1,262 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ *
+ **************************************************************************
+ *
+ * vmstat - see vmstat.h.
+ *
+ * Alarm - the I/O error and timeout counts of SCSI, SATA and USB disks are
+ * read from sysfs, only while the alarm is on. Disks that show up after the
+ * alarm was turned on are not watched.
+ */
+
+
+#define VMSTAT "/proc/vmstat"
+#define IOERRORS "/sys/block/*/device/ioerr_cnt"
+#define IOTIMEOUTS "iotmo_cnt"
+#define MAXDISKS 16
+#define NALARMS 2       /* I/O errors, I/O timeouts */
+#define MAXCOUNTERS (PILED_MAXCOUNTERS - NALARMS)
+
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "vmstat.h"
+
+
+struct config {
+        unsigned int ncounters;
+        char counters[MAXCOUNTERS][32];
+        int alarm;              /* Read the error counters of the disks */
+};
+
+static struct config staged;            /* read from the config file */
+static struct config *cfg = NULL;       /* in use */
+static struct config *pending = NULL;   /* built last, not yet in use */
+static int staged_counters = 0;
+
+static FILE *vmstat = NULL;
+static char *line = NULL;
+static size_t len = 0;
+
+static int ioerrors[MAXDISKS];
+static int iotimeouts[MAXDISKS];
+static unsigned int ndisks = 0;
+static int disks_open = 0;
+
+/* Open the I/O error and timeout counters of the disks */
+static void open_disks(void) {
+        glob_t found;
+        char path[PATH_MAX];
+        size_t i;
+
+        if (glob(IOERRORS, 0, NULL, &found))
+                return;
+        for (i = 0; i < found.gl_pathc && ndisks < MAXDISKS; i++) {
+                snprintf(path, sizeof(path), "%.*s" IOTIMEOUTS,
+                        (int)(strrchr(found.gl_pathv[i], '/') + 1 - found.gl_pathv[i]),
+                        found.gl_pathv[i]);
+                ioerrors[ndisks] = open(found.gl_pathv[i], O_RDONLY | O_CLOEXEC);
+                iotimeouts[ndisks] = open(path, O_RDONLY | O_CLOEXEC);
+                if (ioerrors[ndisks] >= 0 && iotimeouts[ndisks] >= 0) {
+                        ndisks++;
+                        continue;
+                }
+                if (ioerrors[ndisks] >= 0) close(ioerrors[ndisks]);
+                if (iotimeouts[ndisks] >= 0) close(iotimeouts[ndisks]);
+        }
+        globfree(&found);
+        disks_open = 1;
+}
+
+/* Close the counters of the disks */
+static void close_disks(void) {
+        while (ndisks) {
+                ndisks--;
+                close(ioerrors[ndisks]);
+                close(iotimeouts[ndisks]);
+        }
+        disks_open = 0;
+}
+
+/* Read a counter of a disk; they are in hex */
+static uint64_t disk_counter(int fd) {
+        char buf[32];
+        ssize_t n;
+
+        n = TEMP_FAILURE_RETRY(pread(fd, buf, sizeof(buf) - 1, 0));
+        if (n <= 0)
+                return 0;
+        buf[n] = '\0';
+        return strtoull(buf, NULL, 0);
+}
+
+/* Reread the vmstat file; the source of the graph */
+static int sample(void *arg, uint64_t *values) {
+        const struct config *c = arg;
+        char name[32];
+        uint64_t value;
+        unsigned int found, i;
+        int result;
+
+        /* Open the vmstat file, and the disks, on first use */
+        if (!vmstat) {
+                vmstat = fopen(VMSTAT, "r");
+                if (!vmstat) {
+                        perror("Could not open " VMSTAT " for reading");
+                        return -1;
+                }
+        }
+        if (c->alarm && !disks_open)
+                open_disks();
+
+        /* Reload the vmstat file */
+        result = TEMP_FAILURE_RETRY(fseek(vmstat, 0L, SEEK_SET));
+        if (result) {
+                perror("Could not rewind " VMSTAT);
+                return result;
+        }
+
+        /* Clear glibc's buffer */
+        result = TEMP_FAILURE_RETRY(fflush(vmstat));
+        if (result) {
+                perror("Could not flush input stream");
+                return result;
+        }
+
+        /* Extract the I/O stats */
+        found = 0;
+        errno = 0;
+        while (found < c->ncounters && getline(&line, &len, vmstat) != -1 && errno != EINTR) {
+                if (sscanf(line, "%31s %" SCNu64, name, &value) != 2)
+                        continue;
+                for (i = 0; i < c->ncounters; i++) {
+                        if (!strcmp(name, c->counters[i])) {
+                                values[i] = value;
+                                found++;
+                        }
+                }
+        }
+        if (found < c->ncounters) {
+                fprintf(stderr, "Could not find required lines in " VMSTAT "\n");
+                return -1;
+        }
+
+        /* Add up the error counters of the disks */
+        if (!c->alarm)
+                return 0;
+        values[c->ncounters] = values[c->ncounters + 1] = 0;
+        for (i = 0; i < ndisks; i++) {
+                values[c->ncounters] += disk_counter(ioerrors[i]);
+                values[c->ncounters + 1] += disk_counter(iotimeouts[i]);
+        }
+
+        return 0;
+}
+
+void vmstat_defaults(void) {
+        memset(&staged, 0, sizeof(staged));
+        staged.ncounters = 2;
+        strcpy(staged.counters[0], "pgpgin");
+        strcpy(staged.counters[1], "pgpgout");
+        staged_counters = 0;
+}
+
+int vmstat_setting(struct piled_settings *s, const char *key, const char *value, const char **error) {
+        if (strcmp(key, "counter"))
+                return 1;
+
+        /* The first counter replaces the default ones */
+        if (!staged_counters++)
+                staged.ncounters = 0;
+        if (staged.ncounters == MAXCOUNTERS)
+                *error = "too many counters";
+        else if (!*value || strlen(value) >= sizeof(staged.counters[0]))
+                *error = "invalid counter name";
+        else
+                strcpy(staged.counters[staged.ncounters++], value);
+        return *error ? -1 : 0;
+}
+
+int vmstat_build(struct piled *p, const struct piled_settings *s) {
+        const char *names[MAXCOUNTERS + NALARMS];
+        struct config *c;
+        unsigned int i;
+
+        c = malloc(sizeof(*c));
+        if (!c) {
+                perror("Could not allocate settings");
+                return -1;
+        }
+        *c = staged;
+        c->alarm = s->alarm == PILED_ALARM_ON;
+
+        /* The error counters are only there for the alarm */
+        for (i = 0; i < c->ncounters; i++)
+                names[i] = c->counters[i];
+        if (c->alarm) {
+                names[i++] = "ioerr_cnt";
+                names[i++] = IOTIMEOUTS;
+        }
+        if (piled_add_source(p, "vmstat", names, i, c->alarm ? NALARMS : 0, sample, c) < 0) {
+                free(c);
+                return -1;
+        }
+
+        free(pending);
+        pending = c;
+        return 0;
+}
+
+void vmstat_commit(int ok) {
+        if (ok) {
+                free(cfg);
+                cfg = pending;
+                if (cfg && !cfg->alarm)
+                        close_disks();
+        } else {
+                free(pending);
+        }
+        pending = NULL;
+}
+
+void vmstat_cleanup(void) {
+        free(cfg);
+        cfg = NULL;
+        if (line) free(line);
+        if (vmstat) fclose(vmstat);
+        close_disks();
+}
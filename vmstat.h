@@ -0,0 +1,54 @@
+/*
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or
+ * distribute this software, either in source code form or as a compiled
+ * binary, for any purpose, commercial or non-commercial, and by any
+ * means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors
+ * of this software dedicate any and all copyright interest in the
+ * software to the public domain. We make this dedication for the benefit
+ * of the public at large and to the detriment of our heirs and
+ * successors. We intend this dedication to be an overt act of
+ * relinquishment in perpetuity of all present and future rights to this
+ * software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ *
+ **************************************************************************
+ *
+ * The source of hddledPi and actledPi: counters of /proc/vmstat, and the
+ * I/O error and timeout counters of the disks when the alarm is on. It has
+ * the same hooks as struct piled_program, for the programs to call from theirs.
+ */
+
+#ifndef VMSTAT_H
+#define VMSTAT_H
+
+#include "piled.h"
+
+/* Watch pgpgin and pgpgout */
+void vmstat_defaults(void);
+
+/* The "counter" config file setting; returns 1 for other keys */
+int vmstat_setting(struct piled_settings *s, const char *key, const char *value, const char **error);
+
+/* Add the source to the graph */
+int vmstat_build(struct piled *p, const struct piled_settings *s);
+
+/* The graph built last is now in use (ok), or has been dropped */
+void vmstat_commit(int ok);
+
+/* Close the files */
+void vmstat_cleanup(void);
+
+#endif /* VMSTAT_H */